@@ -0,0 +1,189 @@
+// Benchmark driver for cfd.c: times simulation_step(), the quantizer pass and
+// display_grid() separately, plus a full step + render frame, over a sweep of grid
+// sizes and obstacle densities. Results go to stdout as JSON; the frames drawn by
+// display_grid() are sent to /dev/null.
+//
+//   make bench && ./cfd_bench > bench.json
+#define CFD_NO_MAIN
+#include "cfd.c"
+
+// --- Bench Settings (with defaults) ---
+static int    B_MIN_SIZE = 64;          // Smallest grid side
+static int    B_MAX_SIZE = 8192;        // Largest grid side (sides double from the smallest)
+static int    B_WARMUP = 2;             // Untimed repetitions before measuring
+static int    B_MIN_REPS = 5;           // Timed repetitions, at least...
+static int    B_MAX_REPS = 200;         // ...and at most
+static double B_BUDGET_S = 0.5;         // Stop adding repetitions after this much time per phase
+static const double B_DENSITIES[] = { 0.0, 0.1, 0.3 }; // Fraction of interior cells that are walls
+
+#define N_DENSITIES ((int)(sizeof(B_DENSITIES) / sizeof(B_DENSITIES[0])))
+
+static FILE *json_out;        // Real stdout, kept before stdout is pointed at /dev/null
+static volatile char sink;    // Keeps the quantizer loop from being optimized away
+
+static void bench_usage(const char *prog_name) {
+    printf("Usage: %s [options] > results.json\n", prog_name);
+    printf("Options:\n");
+    printf("  --min-size <n>     Smallest grid side (int, default: %d)\n", B_MIN_SIZE);
+    printf("  --max-size <n>     Largest grid side (int, default: %d)\n", B_MAX_SIZE);
+    printf("  --warmup <n>       Untimed repetitions per phase (int, default: %d)\n", B_WARMUP);
+    printf("  --reps <min>:<max> Timed repetitions per phase (default: %d:%d)\n", B_MIN_REPS, B_MAX_REPS);
+    printf("  --budget <s>       Time budget per phase in seconds (float, default: %.2f)\n", B_BUDGET_S);
+    printf("  --threads <n>      Worker threads for the step (int, default: %d)\n", G_THREADS);
+    printf("  --kernel <name>    Step kernel: auto, scalar, avx2, avx512 (default: auto)\n");
+    printf("  --integrator <n>   Time integrator: explicit, implicit, spectral (default: explicit;\n"
+           "                     spectral runs obstacle-free (size + 2)^2 grids only)\n");
+    printf("  -h, --help         Show this help message\n");
+}
+
+// Walls on the border ring plus a random `density` fraction of the interior
+static void place_obstacles(double density) {
+    unsigned int seed = 12345u;
+    for (int r = 1; r < HEIGHT - 1; r++) {
+        for (int c = 1; c < WIDTH - 1; c++) {
+            seed = seed * 1103515245u + 12345u;
+            if ((double)((seed >> 8) & 0xFFFF) / 65536.0 < density) {
+                bits_assign(&obstacle, r, c, 1);
+                GRID_AT(h, r, c) = 0.0f;
+            }
+        }
+    }
+    build_step_plan();
+}
+
+// The quantizer pass of display_grid(), without the output
+static void phase_quantize(void) {
+    static char *row = NULL, *prev = NULL;
+    static int row_width = 0;
+    if (row_width < WIDTH) {
+        free(row); free(prev);
+        row = (char *)malloc((size_t)WIDTH);
+        prev = (char *)calloc((size_t)WIDTH, 1);
+        if (!row || !prev) { fprintf(stderr, "Error: out of memory.\n"); exit(EXIT_FAILURE); }
+        row_width = WIDTH;
+    }
+    size_t changed = 0;
+    for (int r = 0; r < HEIGHT; r++) {
+        changed += quantize_row(row, prev, GRID_ROW(h, r), BITS_ROW(obstacle, r), WIDTH);
+    }
+    sink = (char)(changed ^ (size_t)row[WIDTH / 2]);
+}
+
+static void phase_step(void) { simulation_step(); }
+// A full redraw every time: h does not change between repetitions, so the
+// differential renderer would otherwise send nothing after the first
+static void phase_display(void) { renderer_invalidate(); display_grid(); }
+static void phase_frame(void) { simulation_step(); display_grid(); }
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Warm up, then time repetitions of `fn` and emit one JSON result object
+static void run_phase(const char *name, void (*fn)(void), double density, int *first) {
+    double samples[1024];
+    int max_reps = B_MAX_REPS < 1024 ? B_MAX_REPS : 1024;
+    int reps = 0;
+    double total = 0.0;
+
+    for (int i = 0; i < B_WARMUP; i++) fn();
+    while (reps < max_reps && (reps < B_MIN_REPS || total < B_BUDGET_S)) {
+        double t0 = now_seconds();
+        fn();
+        samples[reps] = now_seconds() - t0;
+        total += samples[reps++];
+    }
+    qsort(samples, reps, sizeof(double), compare_doubles);
+    double median = (reps % 2) ? samples[reps / 2] : 0.5 * (samples[reps / 2 - 1] + samples[reps / 2]);
+    int p95_index = (int)ceil(0.95 * reps) - 1;
+    double p95 = samples[p95_index < 0 ? 0 : p95_index];
+    double cells = (double)WIDTH * (double)HEIGHT;
+
+    fprintf(json_out, "%s\n    {\"phase\": \"%s\", \"width\": %d, \"height\": %d, \"obstacle_density\": %.2f, "
+            "\"reps\": %d, \"median_s\": %.9f, \"p95_s\": %.9f, \"cells_per_s\": %.1f}",
+            *first ? "" : ",", name, WIDTH, HEIGHT, density, reps, median, p95,
+            median > 0.0 ? cells / median : 0.0);
+    fflush(json_out);
+    *first = 0;
+}
+
+int main(int argc, char *argv[]) {
+    for (int k = 1; k < argc; ++k) {
+        if (strcmp(argv[k], "--min-size") == 0) {
+            if (++k < argc) B_MIN_SIZE = atoi(argv[k]); else { bench_usage(argv[0]); return 1; }
+        } else if (strcmp(argv[k], "--max-size") == 0) {
+            if (++k < argc) B_MAX_SIZE = atoi(argv[k]); else { bench_usage(argv[0]); return 1; }
+        } else if (strcmp(argv[k], "--warmup") == 0) {
+            if (++k < argc) B_WARMUP = atoi(argv[k]); else { bench_usage(argv[0]); return 1; }
+        } else if (strcmp(argv[k], "--reps") == 0) {
+            if (++k >= argc || sscanf(argv[k], "%d:%d", &B_MIN_REPS, &B_MAX_REPS) != 2) { bench_usage(argv[0]); return 1; }
+        } else if (strcmp(argv[k], "--budget") == 0) {
+            if (++k < argc) B_BUDGET_S = atof(argv[k]); else { bench_usage(argv[0]); return 1; }
+        } else if (strcmp(argv[k], "--threads") == 0) {
+            if (++k < argc) G_THREADS = atoi(argv[k]); else { bench_usage(argv[0]); return 1; }
+        } else if (strcmp(argv[k], "--kernel") == 0) {
+            if (++k >= argc) { bench_usage(argv[0]); return 1; }
+            G_KERNEL = -1;
+            for (int i = 0; i < (int)(sizeof(KERNEL_NAMES) / sizeof(KERNEL_NAMES[0])); i++) {
+                if (strcmp(argv[k], KERNEL_NAMES[i]) == 0) G_KERNEL = i;
+            }
+            if (G_KERNEL < 0) { fprintf(stderr, "Error: unknown kernel '%s'.\n", argv[k]); return 1; }
+        } else if (strcmp(argv[k], "--integrator") == 0) {
+            if (++k >= argc) { bench_usage(argv[0]); return 1; }
+            G_INTEGRATOR = -1;
+            for (int i = 0; i < (int)(sizeof(INTEGRATOR_NAMES) / sizeof(INTEGRATOR_NAMES[0])); i++) {
+                if (strcmp(argv[k], INTEGRATOR_NAMES[i]) == 0) G_INTEGRATOR = i;
+            }
+            if (G_INTEGRATOR < 0) { fprintf(stderr, "Error: unknown integrator '%s'.\n", argv[k]); return 1; }
+        } else if (strcmp(argv[k], "-h") == 0 || strcmp(argv[k], "--help") == 0) {
+            bench_usage(argv[0]); return 0;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[k]);
+            bench_usage(argv[0]); return 1;
+        }
+    }
+    if (B_MIN_SIZE < 3 || B_MAX_SIZE < B_MIN_SIZE) { fprintf(stderr, "Error: need 3 <= min-size <= max-size.\n"); return 1; }
+    if (B_MIN_REPS < 1 || B_MAX_REPS < B_MIN_REPS) { fprintf(stderr, "Error: need 1 <= min reps <= max reps.\n"); return 1; }
+    if (G_THREADS < 1) { fprintf(stderr, "Error: threads must be >= 1.\n"); return 1; }
+
+    int kernel = select_kernel();
+    if (kernel < 0) {
+        fprintf(stderr, "Error: kernel '%s' is not supported on this CPU.\n", KERNEL_NAMES[G_KERNEL]);
+        return 1;
+    }
+    select_quantizer(kernel);
+    select_implicit_kernel(kernel);
+
+    // JSON goes to the real stdout; display_grid() output is discarded
+    json_out = fdopen(dup(STDOUT_FILENO), "w");
+    if (!json_out || !freopen("/dev/null", "w", stdout)) {
+        fprintf(stderr, "Error: could not redirect stdout.\n");
+        return 1;
+    }
+
+    int threads = pool_start(G_THREADS);
+    fprintf(json_out, "{\n  \"kernel\": \"%s\",\n  \"integrator\": \"%s\",\n  \"threads\": %d,\n  \"results\": [",
+            KERNEL_NAMES[kernel], INTEGRATOR_NAMES[G_INTEGRATOR], threads);
+    int first = 1;
+    for (int size = B_MIN_SIZE; size <= B_MAX_SIZE; size *= 2) {
+        // The spectral integrator needs a power-of-two water region and no interior walls
+        int spectral = G_INTEGRATOR == INTEGRATOR_SPECTRAL;
+        WIDTH = HEIGHT = spectral ? size + 2 : size;
+        allocate_grids();
+        for (int d = 0; d < (spectral ? 1 : N_DENSITIES); d++) {
+            fprintf(stderr, "bench: %dx%d, obstacle density %.2f\n", size, size, B_DENSITIES[d]);
+            initialize_simulation();
+            place_obstacles(B_DENSITIES[d]);
+            run_phase("step", phase_step, B_DENSITIES[d], &first);
+            run_phase("quantize", phase_quantize, B_DENSITIES[d], &first);
+            run_phase("display", phase_display, B_DENSITIES[d], &first);
+            run_phase("frame", phase_frame, B_DENSITIES[d], &first);
+        }
+        free_grids();
+    }
+    fprintf(json_out, "\n  ]\n}\n");
+    fclose(json_out);
+    pool_stop();
+    return 0;
+}
@@ -1,7 +1,19 @@
+// glibc declares syscall() and usleep() only for _DEFAULT_SOURCE builds; the Makefile's
+// -D_POSIX_C_SOURCE alone would hide them
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h> // For ptrdiff_t
+#include <stdint.h> // For uint64_t
 #include <math.h> // For fabsf, sqrtf, fmaxf, fminf
+#include <signal.h> // For SIGINT/SIGTERM clean shutdown
+
+// Set by SIGINT/SIGTERM so the main loop can exit through free_grids()
+volatile sig_atomic_t g_stop = 0;
+static void handle_stop_signal(int sig) { (void)sig; g_stop = 1; }
 
 #ifdef _WIN32
 #include <windows.h>
@@ -16,9 +28,37 @@ void get_terminal_size(int *width, int *height) {
     if (*width <=0) *width = 80; // Fallback
     if (*height <=0) *height = 24; // Fallback
 }
+// Monotonic wall clock in seconds
+double now_seconds(void) {
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart / (double)freq.QuadPart;
+}
+// Sleep until now_seconds() reaches `deadline` (returns at once if it has passed)
+void sleep_until(double deadline) {
+    double remaining = deadline - now_seconds();
+    if (remaining > 0.0) Sleep((DWORD)(remaining * 1000.0));
+}
 #else // macOS, Linux, etc.
 #include <unistd.h>    // For usleep, STDOUT_FILENO
 #include <sys/ioctl.h> // For ioctl, TIOCGWINSZ, struct winsize
+#include <time.h>      // For clock_gettime, clock_nanosleep
+#include <errno.h>
+#include <pthread.h>   // Worker pool
+#include <sched.h>     // For sched_yield
+#include <stdatomic.h>
+#include <fcntl.h>     // Checkpoint files
+#include <sys/mman.h>  // For mmap (checkpoint restore)
+#include <sys/stat.h>
+#include <sys/wait.h>  // For waitpid (sweep workers)
+#ifdef __linux__
+#include <linux/perf_event.h> // --perf-counters
+#include <linux/futex.h>      // For FUTEX_WAIT/FUTEX_WAKE (--procs)
+#include <sys/syscall.h>      // For SYS_perf_event_open, SYS_futex, SYS_sched_setaffinity
+#include <limits.h>           // For INT_MAX
+#endif
+#define CFD_THREADS 1  // Multithreaded stepping is available
 #define CLEAR_SCREEN() printf("\033[H\033[J") // ANSI escape for clear screen & home
 #define SLEEP_MS(ms) usleep(ms * 1000)
 void get_terminal_size(int *width, int *height) {
@@ -34,11 +74,37 @@ void get_terminal_size(int *width, int *height) {
     if (*width <=0) *width = 80; // Extra fallback
     if (*height <=0) *height = 24; // Extra fallback
 }
+// Monotonic wall clock in seconds
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+// Sleep until now_seconds() reaches `deadline` (returns at once if it has passed).
+// An absolute deadline does not drift with the time spent between sleeps.
+void sleep_until(double deadline) {
+    struct timespec ts;
+#ifdef __APPLE__ // No clock_nanosleep: sleep for the remaining interval instead
+    double remaining = deadline - now_seconds();
+    if (remaining <= 0.0) return;
+    ts.tv_sec = (time_t)remaining;
+    ts.tv_nsec = (long)((remaining - (double)ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+#else
+    if (deadline <= now_seconds()) return;
+    ts.tv_sec = (time_t)deadline;
+    ts.tv_nsec = (long)((deadline - (double)ts.tv_sec) * 1e9);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && !g_stop) {}
+#endif
+}
 #endif
 
 // Grid dimensions (will be set dynamically)
 int WIDTH;
 int HEIGHT;
+// Screen cells drawn per frame: the grid size, or less when a larger grid is pooled down
+int VIEW_W;
+int VIEW_H;
 
 // --- Global Simulation Parameters (with defaults) ---
 float G_DT = 0.2f;                   // Time step. Critical for stability.
@@ -46,14 +112,316 @@ float G_WAVE_SPEED_SQ = 0.5f;        // Square of wave propagation "speed" (cont
 float G_DAMPING = 0.01f;             // Damping factor for wave energy (0.0 to 1.0 range for DT*Damping)
 float G_INITIAL_WATER_LEVEL = 0.5f;  // Initial water level (0.0 to 1.0, where 1.0 is max cell capacity)
 float G_INITIAL_TILT = 0.1f;         // Initial surface tilt (0.0 to 1.0) to start sloshing
-int   G_SLEEP_MS = 50;               // Sleep time per frame in ms
+int   G_SLEEP_MS = 50;               // Frame period in ms (unless --fps is given)
+float G_FPS = 0.0f;                  // Target frame rate (0 = 1000 / G_SLEEP_MS)
+float G_SIM_RATE = 0.0f;             // Simulated time per wall-clock second (0 = one step per frame)
+int   G_ADAPTIVE = 0;                // Adapt dt to the field instead of keeping G_DT fixed
+float G_ADAPT_DH = 0.01f;            // Adaptive mode: largest height change per step (max|vel| * dt)
+double G_SIM_TIME = 0.0;             // Stop after this much simulated time (0 = no limit)
+int   G_THREADS = 1;                 // Worker threads used by simulation_step()
+int   G_TIME_BLOCK = 1;              // Steps advanced per cache-sized tile (1 = plain stepping)
+int   G_HEADLESS = 0;                // Run without rendering, sleeping or the startup pause
+float G_REDRAW_THRESHOLD = 0.5f;     // Changed-screen fraction above which a frame is fully redrawn
+int   G_ASYNC_RENDER = 0;            // Simulate and render on separate threads
+int   G_STATS = 0;                   // Report renderer/throughput statistics
+long  G_STEPS = 0;                   // Steps to run (0 = until interrupted)
+int   G_GRID_W = 0, G_GRID_H = 0;    // Explicit grid size (0 = size from the terminal)
+int   G_ACTIVE_TILES = 0;            // Only step tiles that are still moving
+float G_QUIESCENCE = 1e-4f;          // Active tiles: max |vel| and |laplacian| below which a tile sleeps
+int   G_STORAGE = 0;                 // Field storage format, STORAGE_* (0 = fp32)
+int   G_POOL = 0;                    // Reduction for grids larger than the screen, POOL_* (0 = max)
+long  G_CHECKPOINT_EVERY = 0;        // Write a checkpoint every n steps (0 = never)
+const char *G_CHECKPOINT_FILE = "cfd.ckpt"; // Where checkpoints are written
+const char *G_RESTORE = NULL;        // Checkpoint to resume from (NULL = fresh start)
+const char *G_SWEEP_OUT = "sweep.csv";  // CSV written by --sweep
+const char *G_MAP = NULL;            // PGM/ASCII map of walls and heights to start from (NULL = default tank)
+int   G_INTEGRATOR = 0;              // Time integrator, INTEGRATOR_* (0 = explicit)
+float G_CG_TOL = 1e-3f;              // Implicit integrator: residual the solver stops at, relative to h' = h
+int   G_PROCS = 1;                   // Worker processes owning row slabs (1 = step in this process)
+
+
+// --- Grid Storage ---
+// Each field lives in one aligned block. Rows are padded so every row starts on a
+// cache line, which keeps the stencil's row walks prefetch- and vector-friendly.
+#define GRID_ALIGN 64 // Cache line size in bytes
+
+typedef struct {
+    float *data;    // Single block holding all rows
+    int width;      // Usable cells per row
+    int height;     // Number of rows
+    size_t stride;  // Elements between the starts of consecutive rows (>= width)
+} grid_f;
+
+// One bit per cell, 64 cells per word; rows padded to whole cache lines like grid_f.
+// Bits past `width` in the last word of a row are always 0.
+typedef struct {
+    uint64_t *words;
+    int width;
+    int height;
+    size_t stride;  // Words between the starts of consecutive rows
+} grid_bits;
+
+// 16-bit field storage (--storage); the encoding is chosen by G_STORAGE
+typedef struct {
+    uint16_t *data;
+    int width;
+    int height;
+    size_t stride;  // Elements between the starts of consecutive rows
+} grid_u16;
+
+enum { STORAGE_FP32, STORAGE_FP16, STORAGE_BF16, STORAGE_FIXED16 };
+
+#define GRID_ROW(g, r)   ((g).data + (size_t)(r) * (g).stride)
+#define GRID_AT(g, r, c) (GRID_ROW(g, r)[c])
+
+#define BITS_ROW(g, r)   ((g).words + (size_t)(r) * (g).stride)
+#define BITS_AT(g, r, c) ((int)((BITS_ROW(g, r)[(c) >> 6] >> ((c) & 63)) & 1u))
+
+// Round a row of `count` elements of `elem_size` bytes up to a whole number of cache lines
+static size_t grid_stride(int count, size_t elem_size) {
+    size_t bytes = (size_t)count * elem_size;
+    bytes = (bytes + GRID_ALIGN - 1) / GRID_ALIGN * GRID_ALIGN;
+    return bytes / elem_size;
+}
+
+// Allocate a zeroed, GRID_ALIGN-aligned block (NULL on failure)
+static void *aligned_block_alloc(size_t bytes) {
+    void *p;
+    if (bytes == 0) bytes = GRID_ALIGN;
+#ifdef _WIN32
+    p = _aligned_malloc(bytes, GRID_ALIGN);
+#else
+    if (posix_memalign(&p, GRID_ALIGN, bytes) != 0) p = NULL;
+#endif
+    if (p) memset(p, 0, bytes);
+    return p;
+}
+
+// A restored checkpoint is mapped as one block; grids pointing into it are released
+// with the mapping, not one by one (see Checkpoints)
+static char *restore_map = NULL;
+static size_t restore_map_bytes = 0;
+
+static void aligned_block_free(void *p) {
+    if (restore_map && (char *)p >= restore_map && (char *)p < restore_map + restore_map_bytes) return;
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+static int grid_f_alloc(grid_f *g, int width, int height) {
+    g->width = width;
+    g->height = height;
+    g->stride = grid_stride(width, sizeof(float));
+    g->data = (float *)aligned_block_alloc(g->stride * (size_t)height * sizeof(float));
+    return g->data != NULL;
+}
+
+static int grid_u16_alloc(grid_u16 *g, int width, int height) {
+    g->width = width;
+    g->height = height;
+    g->stride = grid_stride(width, sizeof(uint16_t));
+    g->data = (uint16_t *)aligned_block_alloc(g->stride * (size_t)height * sizeof(uint16_t));
+    return g->data != NULL;
+}
+
+static int grid_bits_alloc(grid_bits *g, int width, int height) {
+    g->width = width;
+    g->height = height;
+    g->stride = grid_stride((width + 63) / 64, sizeof(uint64_t));
+    g->words = (uint64_t *)aligned_block_alloc(g->stride * (size_t)height * sizeof(uint64_t));
+    return g->words != NULL;
+}
+
+static void bits_assign(grid_bits *g, int r, int c, int value) {
+    uint64_t *word = BITS_ROW(*g, r) + (c >> 6);
+    uint64_t bit = (uint64_t)1 << (c & 63);
+    *word = value ? (*word | bit) : (*word & ~bit);
+}
+
+// Mask of the cells of word `w` that lie inside a row of `width` cells
+static inline uint64_t bits_valid_mask(int width, int w) {
+    int left = width - w * 64;
+    return left >= 64 ? ~(uint64_t)0 : (((uint64_t)1 << left) - 1);
+}
+
+static void grid_f_free(grid_f *g) { aligned_block_free(g->data); g->data = NULL; }
+static void grid_u16_free(grid_u16 *g) { aligned_block_free(g->data); g->data = NULL; }
+static void grid_bits_free(grid_bits *g) { aligned_block_free(g->words); g->words = NULL; }
+
+// Swap two grids of identical shape (used for the double-buffer flip)
+static void grid_f_swap(grid_f *a, grid_f *b) {
+    grid_f tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+static void grid_u16_swap(grid_u16 *a, grid_u16 *b) {
+    grid_u16 tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+// --- Grid Data ---
+grid_f h;          // Current water height in each cell
+grid_f vel;        // Vertical velocity of the water surface in each cell
+grid_f next_h;     // Buffer for calculating the next height state
+grid_f next_vel;   // Buffer for calculating the next velocity state
+grid_bits obstacle; // Bit set if the cell is a wall, clear if it's water
+
+// With --storage other than fp32 the four fields above are left unallocated and live
+// here in 16 bits instead; the step widens rows to fp32 scratch (see Reduced-Precision Storage)
+grid_u16 h16, vel16, next_h16, next_vel16;
+
+// --- Run State ---
+float g_max_vel = 0.0f;      // Largest |vel| after the last step (step monitor)
+double g_sim_time = 0.0;     // Simulated time covered so far
+long long g_step_count = 0;  // Steps taken so far
+
+// --- Phase Timing ---
+// With --stats, each phase of a frame is timed with the monotonic clock and the
+// durations are counted in log2 buckets (bucket b holds [2^(b-1), 2^b) ns), so a
+// sample costs two clock reads and an increment. The histograms are printed on
+// exit, or to stderr on SIGUSR1. Building with -DCFD_NO_STATS (make STATS=0)
+// removes the timers entirely. Each phase is only ever recorded by one thread.
+enum { PHASE_STEP, PHASE_QUANTIZE, PHASE_OUTPUT, PHASE_SLEEP, PHASE_CHECKPOINT, N_PHASES };
+
+#ifndef CFD_NO_STATS
+static const char *const PHASE_NAMES[N_PHASES] = { "step", "quantize", "output", "sleep", "checkpoint" };
+#define STATS_BUCKETS 64
+
+typedef struct {
+    unsigned long long buckets[STATS_BUCKETS];
+    unsigned long long count;
+    double total;             // Seconds
+    double max;
+} phase_hist;
+
+static phase_hist phase_stats[N_PHASES];
+volatile sig_atomic_t g_stats_request = 0; // Set by SIGUSR1
+
+#define STATS_BEGIN(t0) double t0 = G_STATS ? now_seconds() : 0.0
+#define STATS_END(phase, t0) do { if (G_STATS) stats_record(phase, now_seconds() - (t0)); } while (0)
+
+static void stats_record(int phase, double seconds) {
+    phase_hist *ph = &phase_stats[phase];
+    unsigned long long ns = seconds > 0.0 ? (unsigned long long)(seconds * 1e9) : 0;
+    ph->buckets[ns ? 64 - __builtin_clzll(ns) : 0]++;
+    ph->count++;
+    ph->total += seconds;
+    if (seconds > ph->max) ph->max = seconds;
+}
+
+// Format a duration with a unit that keeps it readable
+static const char *stats_time(char *buf, size_t len, double seconds) {
+    if (seconds < 1e-6) snprintf(buf, len, "%.0f ns", seconds * 1e9);
+    else if (seconds < 1e-3) snprintf(buf, len, "%.1f us", seconds * 1e6);
+    else if (seconds < 1.0) snprintf(buf, len, "%.1f ms", seconds * 1e3);
+    else snprintf(buf, len, "%.2f s", seconds);
+    return buf;
+}
+
+// Upper edge of the bucket holding quantile q
+static double stats_quantile(const phase_hist *ph, double q) {
+    unsigned long long seen = 0, want = (unsigned long long)ceil(q * (double)ph->count);
+    for (int b = 0; b < STATS_BUCKETS; b++) {
+        seen += ph->buckets[b];
+        if (seen >= want && ph->buckets[b]) return fmin(ldexp(1.0, b) * 1e-9, ph->max);
+    }
+    return ph->max;
+}
+
+// Print every recorded phase: summary table, share of the timed total, then histograms
+void stats_report(FILE *out) {
+    char a[32], b[32], c[32], d[32];
+    double all = 0.0;
+    for (int p = 0; p < N_PHASES; p++) all += phase_stats[p].total;
+    if (all <= 0.0) return;
+    fprintf(out, "Phase timings (p50/p99 are log2 bucket upper bounds, capped at max):\n");
+    fprintf(out, "  %-10s %10s %10s %6s %10s %10s %10s %10s\n", "phase", "count", "total", "share", "mean", "p50", "p99", "max");
+    for (int p = 0; p < N_PHASES; p++) {
+        const phase_hist *ph = &phase_stats[p];
+        if (!ph->count) continue;
+        fprintf(out, "  %-10s %10llu %8.3f s %5.1f%% %10s %10s %10s %10s\n", PHASE_NAMES[p], ph->count, ph->total,
+                100.0 * ph->total / all, stats_time(a, sizeof(a), ph->total / ph->count),
+                stats_time(b, sizeof(b), stats_quantile(ph, 0.5)), stats_time(c, sizeof(c), stats_quantile(ph, 0.99)),
+                stats_time(d, sizeof(d), ph->max));
+    }
+    double compute = phase_stats[PHASE_STEP].total + phase_stats[PHASE_QUANTIZE].total;
+    double output = phase_stats[PHASE_OUTPUT].total;
+    if (output > 0.0) {
+        fprintf(out, "  -> %s-bound: output %.1f%% vs compute (step + quantize) %.1f%% of the busy time\n",
+                output > compute ? "output" : "compute", 100.0 * output / (output + compute),
+                100.0 * compute / (output + compute));
+    }
+    for (int p = 0; p < N_PHASES; p++) {
+        const phase_hist *ph = &phase_stats[p];
+        if (!ph->count) continue;
+        unsigned long long peak = 0;
+        for (int k = 0; k < STATS_BUCKETS; k++) if (ph->buckets[k] > peak) peak = ph->buckets[k];
+        fprintf(out, "  %s:\n", PHASE_NAMES[p]);
+        for (int k = 0; k < STATS_BUCKETS; k++) {
+            if (!ph->buckets[k]) continue;
+            int bar = (int)((40 * ph->buckets[k] + peak - 1) / peak);
+            fprintf(out, "    < %9s %10llu %.*s\n", stats_time(a, sizeof(a), ldexp(1.0, k) * 1e-9), ph->buckets[k],
+                    bar, "########################################");
+        }
+    }
+}
+
+static void handle_stats_signal(int sig) { (void)sig; g_stats_request = 1; }
 
-// --- Grid Data (pointers for dynamic 2D arrays) ---
-float **h;         // Current water height in each cell
-float **vel;       // Vertical velocity of the water surface in each cell
-float **next_h;    // Buffer for calculating the next height state
-float **next_vel;  // Buffer for calculating the next velocity state
-int   **obstacle;  // 1 if the cell is a wall, 0 if it's water
+// Arm SIGUSR1 to request a report (where the platform has it)
+void stats_install(void) {
+#ifdef SIGUSR1
+    if (G_STATS) signal(SIGUSR1, handle_stats_signal);
+#endif
+}
+
+// Print a report requested by SIGUSR1, if any (called from the main loops)
+void stats_poll(void) {
+    if (!g_stats_request) return;
+    g_stats_request = 0;
+    fprintf(stderr, "\n");
+    stats_report(stderr);
+    fflush(stderr);
+}
+#else // Timers compiled out
+#define STATS_BEGIN(t0) ((void)0)
+#define STATS_END(phase, t0) ((void)0)
+void stats_report(FILE *out) { (void)out; }
+void stats_install(void) {}
+void stats_poll(void) {}
+#endif // CFD_NO_STATS
+
+// --- Step Plan (precomputed from the obstacle layout) ---
+// Water cells whose four neighbours are all water are grouped into per-row spans and
+// updated by a loop with no conditionals. Water cells touching a wall or the grid
+// border are listed separately with a mask of which neighbours are water.
+#define NB_UP    1
+#define NB_DOWN  2
+#define NB_LEFT  4
+#define NB_RIGHT 8
+
+typedef struct {
+    int c0, c1;          // Columns [c0, c1) of one row, all fully interior water cells
+} cell_span;
+
+typedef struct {
+    int c;               // Column of the edge cell
+    unsigned char mask;  // NB_* bits set for each neighbour that is water
+} edge_cell;
+
+typedef struct {
+    cell_span *spans;    // Spans of all rows, row-major
+    int *span_start;     // Row r owns spans[span_start[r] .. span_start[r+1])
+    edge_cell *edges;    // Edge cells of all rows, row-major
+    int *edge_start;     // Row r owns edges[edge_start[r] .. edge_start[r+1])
+} step_plan;
+
+step_plan plan;
 
 void print_usage(const char *prog_name) {
     printf("Usage: %s [options]\n", prog_name);
@@ -65,243 +433,4790 @@ void print_usage(const char *prog_name) {
     printf("  --damping <val>        Set damping factor (0.0-1.0 for effective damping, default: %.3f)\n", G_DAMPING);
     printf("  --level <val>          Set initial water level (0.0-1.0, default: %.2f)\n", G_INITIAL_WATER_LEVEL);
     printf("  --tilt <val>           Set initial surface tilt (0.0-1.0, default: %.2f)\n", G_INITIAL_TILT);
-    printf("  --sleep <ms>           Set sleep time per frame in ms (int, default: %d)\n", G_SLEEP_MS);
+    printf("  --sleep <ms>           Set frame period in ms when --fps is not given (int, default: %d)\n", G_SLEEP_MS);
+    printf("  --fps <val>            Target frame rate (float, default: 1000/sleep)\n");
+    printf("  --sim-rate <val>       Simulated time per second; sets steps per frame (float, default: dt per frame)\n");
+    printf("  --adaptive             Adapt dt to the field: grow toward the stability limit when calm\n");
+    printf("  --adapt-dh <val>       Adaptive mode: max height change per step (float, default: %.3f)\n", G_ADAPT_DH);
+    printf("  --sim-time <val>       Stop after this much simulated time (float, default: no limit)\n");
+    printf("  --threads <n>          Worker threads for the simulation step (int, default: %d)\n", G_THREADS);
+    printf("  --time-block <k>       Advance k steps per cache-sized tile before moving on (int, default: %d)\n", G_TIME_BLOCK);
+    printf("  --headless             Run without display, sleeps or startup pause; print throughput on exit\n");
+    printf("  --steps <n>            Stop after n steps (int, default: run until interrupted)\n");
+    printf("  --grid <W>x<H>         Simulation grid size (default: terminal size); larger grids are pooled to the screen\n");
+    printf("  --pool <mode>          Downsampling for grids larger than the screen: max, mean (default: max)\n");
+    printf("  --redraw-threshold <f> Redraw the whole screen when more than this fraction changed (0.0-1.0, default: %.2f)\n", G_REDRAW_THRESHOLD);
+    printf("  --async-render         Simulate and render on separate threads (slow terminals no longer slow the physics)\n");
+    printf("  --stats                Show bytes written per frame; on exit (or SIGUSR1, to stderr) print\n"
+           "                         per-phase timing histograms (step, quantize, output, sleep, checkpoint)\n");
+    printf("  --active-tiles         Skip tiles that have come to rest (woken again by active neighbours)\n");
+    printf("  --quiescence <val>     Active tiles: |vel| and |laplacian| below which a tile sleeps (float, default: %g)\n", G_QUIESCENCE);
+    printf("  --checkpoint-every <n> Write a checkpoint every n steps and on exit (int, default: never)\n");
+    printf("  --checkpoint-file <f>  Checkpoint path (default: %s)\n", G_CHECKPOINT_FILE);
+    printf("  --restore <file>       Resume from a checkpoint (grid, physics and step count come from the file;\n"
+           "                         --dt, --speed_sq and --damping override its physics; --steps and --sim-time\n"
+           "                         count from the original start)\n");
+    printf("  --map <file>           Start from a map: binary PGM (0 = wall, else height v/maxval) or ASCII\n"
+           "                         ('X' = wall, renderer glyphs \" .-=*#@\" = heights); sets the grid size\n");
+    printf("  --sweep <p>=a:b:step   Headless: run every combination of swept parameters (dt, speed_sq, damping,\n"
+           "                         level, tilt; repeatable) in parallel worker processes and write a CSV\n");
+    printf("  --sweep-out <file>     CSV of the sweep: parameters, steps, energy, max height, steps/s,\n"
+           "                         stability of the explicit step (default: %s)\n", G_SWEEP_OUT);
+    printf("  --storage <fmt>        Field storage: fp32, fp16, bf16, fixed16 (default: fp32; headless runs\n"
+           "                         with 16-bit storage also report the error against an fp32 re-run)\n");
+    printf("  --perf-counters        Count cycles, instructions, LLC/branch/dTLB misses around each step (Linux\n"
+           "                         perf_event_open) and print per-cell rates on exit\n");
+    printf("  --integrator <name>    Time integrator: explicit, implicit, spectral (default: explicit). Implicit\n"
+           "                         is Crank-Nicolson with a multigrid-preconditioned CG solve per step; it\n"
+           "                         is stable for any dt, so stiff settings can take far fewer, larger steps.\n"
+           "                         Spectral advances every cosine mode of an obstacle-free tank exactly (FFT,\n"
+           "                         any dt; water sides must be powers of two, e.g. --grid 130x66)\n");
+    printf("  --cg-tol <val>         Implicit: residual the solver stops at, relative to h' = h (float, default: %g)\n", G_CG_TOL);
+    printf("  --procs <n>            Split the grid into n row slabs stepped by separate worker processes\n"
+           "                         (pinned across NUMA nodes; one-row halos through shared memory)\n");
+    printf("  --kernel <name>        Step kernel: auto, scalar, avx2, avx512 (default: auto, picked from CPUID)\n");
     printf("  -h, --help             Show this help message\n");
 }
 
-void allocate_grids() {
-    // Allocate rows of pointers
-    h = (float **)malloc(HEIGHT * sizeof(float *));
-    vel = (float **)malloc(HEIGHT * sizeof(float *));
-    next_h = (float **)malloc(HEIGHT * sizeof(float *));
-    next_vel = (float **)malloc(HEIGHT * sizeof(float *));
-    obstacle = (int **)malloc(HEIGHT * sizeof(int *));
-
-    if (!h || !vel || !next_h || !next_vel || !obstacle) {
-        fprintf(stderr, "Error: Memory allocation failed for grid pointers.\n");
+void free_step_plan() {
+    free(plan.spans); free(plan.span_start);
+    free(plan.edges); free(plan.edge_start);
+    memset(&plan, 0, sizeof(plan));
+}
+
+// Neighbour mask of a water cell: which of its four neighbours exist and are water
+static unsigned char neighbor_mask(int r, int c) {
+    unsigned char m = 0;
+    if (r > 0          && !BITS_AT(obstacle, r - 1, c)) m |= NB_UP;
+    if (r < HEIGHT - 1 && !BITS_AT(obstacle, r + 1, c)) m |= NB_DOWN;
+    if (c > 0          && !BITS_AT(obstacle, r, c - 1)) m |= NB_LEFT;
+    if (c < WIDTH - 1  && !BITS_AT(obstacle, r, c + 1)) m |= NB_RIGHT;
+    return m;
+}
+
+// Classify word `w` of row r, 64 cells at a time: `interior` gets the water cells
+// whose four neighbours are all water, `edge` the remaining water cells, `walls`
+// the obstacle cells.
+static void classify_word(int r, int w, uint64_t *interior, uint64_t *edge, uint64_t *walls) {
+    const int n_words = (WIDTH + 63) / 64;
+    const uint64_t valid = bits_valid_mask(WIDTH, w);
+    const uint64_t *row = BITS_ROW(obstacle, r);
+    uint64_t water = ~row[w] & valid;
+    uint64_t up = r > 0 ? ~BITS_ROW(obstacle, r - 1)[w] & valid : 0;
+    uint64_t down = r < HEIGHT - 1 ? ~BITS_ROW(obstacle, r + 1)[w] & valid : 0;
+    // Left/right neighbours shift in the edge bit of the adjacent word (none past the border)
+    uint64_t prev_water = w > 0 ? ~row[w - 1] : 0;
+    uint64_t next_water = w + 1 < n_words ? ~row[w + 1] & bits_valid_mask(WIDTH, w + 1) : 0;
+    uint64_t left = (water << 1) | (prev_water >> 63);
+    uint64_t right = (water >> 1) | (next_water << 63);
+    *interior = water & up & down & left & right;
+    *edge = water & ~*interior;
+    *walls = row[w] & valid;
+}
+
+// Count the runs of set bits in a row's interior words (one span per run)
+static int count_runs(uint64_t bits, uint64_t *carry) {
+    int runs = __builtin_popcountll(bits & ~((bits << 1) | *carry));
+    *carry = bits >> 63;
+    return runs;
+}
+
+void active_tiles_invalidate(void);
+void implicit_invalidate(void);
+void spectral_invalidate(void);
+
+// Rebuild the step plan. Must be called whenever the obstacle layout changes.
+// Obstacle cells are zeroed in both buffers here, so the step never has to write them.
+// The obstacle bits are classified a word (64 cells) at a time.
+void build_step_plan() {
+    const int n_words = (WIDTH + 63) / 64;
+    free_step_plan();
+    plan.span_start = (int *)malloc((HEIGHT + 1) * sizeof(int));
+    plan.edge_start = (int *)malloc((HEIGHT + 1) * sizeof(int));
+    if (!plan.span_start || !plan.edge_start) {
+        fprintf(stderr, "Error: Memory allocation failed for step plan.\n");
         exit(EXIT_FAILURE);
     }
 
-    // Allocate columns for each row (and initialize with calloc)
-    for (int i = 0; i < HEIGHT; i++) {
-        h[i] = (float *)calloc(WIDTH, sizeof(float));
-        vel[i] = (float *)calloc(WIDTH, sizeof(float));
-        next_h[i] = (float *)calloc(WIDTH, sizeof(float));
-        next_vel[i] = (float *)calloc(WIDTH, sizeof(float));
-        obstacle[i] = (int *)calloc(WIDTH, sizeof(int));
-        if (!h[i] || !vel[i] || !next_h[i] || !next_vel[i] || !obstacle[i]) {
-            fprintf(stderr, "Error: Memory allocation failed for grid row %d.\n", i);
-            // Ideally, free already allocated rows before exiting
-            exit(EXIT_FAILURE);
+    // First pass counts spans and edge cells so each array is allocated once
+    int n_spans = 0, n_edges = 0;
+    for (int r = 0; r < HEIGHT; r++) {
+        plan.span_start[r] = n_spans;
+        plan.edge_start[r] = n_edges;
+        uint64_t carry = 0;
+        for (int w = 0; w < n_words; w++) {
+            uint64_t interior, edge, walls;
+            classify_word(r, w, &interior, &edge, &walls);
+            n_spans += count_runs(interior, &carry);
+            n_edges += __builtin_popcountll(edge);
+        }
+    }
+    plan.span_start[HEIGHT] = n_spans;
+    plan.edge_start[HEIGHT] = n_edges;
+
+    plan.spans = (cell_span *)malloc((n_spans ? n_spans : 1) * sizeof(cell_span));
+    plan.edges = (edge_cell *)malloc((n_edges ? n_edges : 1) * sizeof(edge_cell));
+    if (!plan.spans || !plan.edges) {
+        fprintf(stderr, "Error: Memory allocation failed for step plan.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Second pass fills them in, walking set bits with count-trailing-zeros
+    cell_span *sp = plan.spans;
+    edge_cell *ep = plan.edges;
+    for (int r = 0; r < HEIGHT; r++) {
+        int span_begin = -1;
+        for (int w = 0; w < n_words; w++) {
+            uint64_t interior, edge, walls;
+            classify_word(r, w, &interior, &edge, &walls);
+            for (; edge; edge &= edge - 1) {
+                int c = w * 64 + __builtin_ctzll(edge);
+                ep->c = c; ep->mask = neighbor_mask(r, c); ep++;
+            }
+            for (; walls; walls &= walls - 1) {
+                int c = w * 64 + __builtin_ctzll(walls);
+                // h/vel are only written when not already zero, so the pages of a
+                // restored checkpoint are not copied just to store the same value
+                if (G_STORAGE == STORAGE_FP32) {
+                    GRID_AT(next_h, r, c) = GRID_AT(next_vel, r, c) = 0.0f;
+                    if (GRID_AT(h, r, c) != 0.0f) GRID_AT(h, r, c) = 0.0f;
+                    if (GRID_AT(vel, r, c) != 0.0f) GRID_AT(vel, r, c) = 0.0f;
+                } else { // 0x0000 is 0.0 in every 16-bit encoding
+                    GRID_AT(next_h16, r, c) = GRID_AT(next_vel16, r, c) = 0;
+                    if (GRID_AT(h16, r, c)) GRID_AT(h16, r, c) = 0;
+                    if (GRID_AT(vel16, r, c)) GRID_AT(vel16, r, c) = 0;
+                }
+            }
+            // Span boundaries are the 0->1 and 1->0 transitions of the interior bits
+            for (int c = w * 64; interior || span_begin >= 0; ) {
+                if (span_begin < 0) {
+                    int skip = __builtin_ctzll(interior);
+                    span_begin = c + skip;
+                    interior >>= skip;
+                    c += skip;
+                }
+                uint64_t ones = ~interior;
+                int run = ones ? __builtin_ctzll(ones) : 64;
+                if (c + run >= (w + 1) * 64) break; // Run continues into the next word
+                sp->c0 = span_begin; sp->c1 = c + run; sp++;
+                span_begin = -1;
+                interior = run < 64 ? interior >> run : 0;
+                c += run;
+            }
         }
+        if (span_begin >= 0) { sp->c0 = span_begin; sp->c1 = WIDTH; sp++; }
     }
+    active_tiles_invalidate(); // The new layout starts with every tile awake
+    implicit_invalidate();     // The solver's operator follows the walls
+    spectral_invalidate();     // ...and the spectral mode re-checks them
 }
 
+void time_block_free(void);
+void free_renderer(void);
+void free_monitor(void);
+void free_active_tiles(void);
+void free_storage(void);
+void checkpoint_unmap(void);
+void free_implicit(void);
+void free_spectral(void);
+void storage_store_row(int r, const float *h_row, const float *vel_row);
+void map_convert(void);
+
 void free_grids() {
-    if (!h) return; // Avoid freeing if allocation failed or not called
-    for (int i = 0; i < HEIGHT; i++) {
-        free(h[i]); free(vel[i]);
-        free(next_h[i]); free(next_vel[i]);
-        free(obstacle[i]);
+    // Safe to call on partially allocated or never-allocated grids
+    grid_f_free(&h); grid_f_free(&vel);
+    grid_f_free(&next_h); grid_f_free(&next_vel);
+    grid_u16_free(&h16); grid_u16_free(&vel16);
+    grid_u16_free(&next_h16); grid_u16_free(&next_vel16);
+    grid_bits_free(&obstacle);
+    free_step_plan();
+    time_block_free();
+    free_renderer();
+    free_monitor();
+    free_active_tiles();
+    free_storage();
+    checkpoint_unmap();
+    free_implicit();
+    free_spectral();
+}
+
+void allocate_grids() {
+    // One block per field instead of one allocation per row
+    int ok = 1;
+    if (G_STORAGE == STORAGE_FP32) {
+        ok = grid_f_alloc(&h, WIDTH, HEIGHT) && ok;
+        ok = grid_f_alloc(&vel, WIDTH, HEIGHT) && ok;
+        ok = grid_f_alloc(&next_h, WIDTH, HEIGHT) && ok;
+        ok = grid_f_alloc(&next_vel, WIDTH, HEIGHT) && ok;
+    } else {
+        ok = grid_u16_alloc(&h16, WIDTH, HEIGHT) && ok;
+        ok = grid_u16_alloc(&vel16, WIDTH, HEIGHT) && ok;
+        ok = grid_u16_alloc(&next_h16, WIDTH, HEIGHT) && ok;
+        ok = grid_u16_alloc(&next_vel16, WIDTH, HEIGHT) && ok;
+    }
+    ok = grid_bits_alloc(&obstacle, WIDTH, HEIGHT) && ok;
+    VIEW_W = WIDTH; // Drawn cell for cell unless main() sets a smaller view
+    VIEW_H = HEIGHT;
+
+    if (!ok) {
+        fprintf(stderr, "Error: Memory allocation failed for %dx%d grid.\n", WIDTH, HEIGHT);
+        free_grids();
+        exit(EXIT_FAILURE);
     }
-    free(h); free(vel);
-    free(next_h); free(next_vel);
-    free(obstacle);
 }
 
-void initialize_simulation() {
+// The default tank: border walls, water at --level tilted by --tilt
+static void fill_default_tank(void) {
+    // 16-bit storage: each row is built in fp32 and then narrowed
+    float *row_buf = NULL;
+    if (G_STORAGE != STORAGE_FP32) {
+        row_buf = (float *)malloc(2 * (size_t)WIDTH * sizeof(float));
+        if (!row_buf) {
+            fprintf(stderr, "Error: Memory allocation failed for initial state.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
     for (int r = 0; r < HEIGHT; r++) {
+        float *h_row = row_buf ? row_buf : GRID_ROW(h, r);
+        float *vel_row = row_buf ? row_buf + WIDTH : GRID_ROW(vel, r);
         for (int c = 0; c < WIDTH; c++) {
             if (r == 0 || r == HEIGHT - 1 || c == 0 || c == WIDTH - 1) {
-                obstacle[r][c] = 1; // Set border cells as obstacles (walls)
-                h[r][c] = 0.0f;     // No water in walls
-                vel[r][c] = 0.0f;   // No velocity in walls
+                bits_assign(&obstacle, r, c, 1); // Set border cells as obstacles (walls)
+                h_row[c] = 0.0f;     // No water in walls
+                vel_row[c] = 0.0f;   // No velocity in walls
             } else {
-                obstacle[r][c] = 0; // Interior cells are water
+                bits_assign(&obstacle, r, c, 0); // Interior cells are water
                 // Initial water level with a tilt factor applied across the width
                 // The tilt ranges from -G_INITIAL_TILT to +G_INITIAL_TILT
                 float tilt_effect = G_INITIAL_TILT * (((float)c / (WIDTH - 1.0f)) - 0.5f) * 2.0f;
-                h[r][c] = G_INITIAL_WATER_LEVEL + tilt_effect;
+                h_row[c] = G_INITIAL_WATER_LEVEL + tilt_effect;
                 
                 // Clamp initial height to be within [0.0, 1.0] (0% to 100% cell capacity)
-                h[r][c] = fmaxf(0.0f, h[r][c]);
-                h[r][c] = fminf(1.0f, h[r][c]);
+                h_row[c] = fmaxf(0.0f, h_row[c]);
+                h_row[c] = fminf(1.0f, h_row[c]);
                 
-                vel[r][c] = 0.0f;   // Initial vertical velocity is zero
+                vel_row[c] = 0.0f;   // Initial vertical velocity is zero
             }
         }
-    }
-    
-    // If no tilt, create a small central disturbance to start waves
-    if (fabsf(G_INITIAL_TILT) < 0.001f && HEIGHT > 2 && WIDTH > 2) {
-        int disturb_r = HEIGHT / 2;
-        int disturb_c = WIDTH / 2;
-        if (!obstacle[disturb_r][disturb_c]) { // Check if center is not an obstacle
-             h[disturb_r][disturb_c] = fminf(1.0f, G_INITIAL_WATER_LEVEL + 0.4f); // Create a bump
+
+        // If no tilt, create a small central disturbance to start waves
+        if (fabsf(G_INITIAL_TILT) < 0.001f && HEIGHT > 2 && WIDTH > 2 && r == HEIGHT / 2) {
+            int disturb_c = WIDTH / 2;
+            if (!BITS_AT(obstacle, r, disturb_c)) { // Check if center is not an obstacle
+                 h_row[disturb_c] = fminf(1.0f, G_INITIAL_WATER_LEVEL + 0.4f); // Create a bump
+            }
         }
+        if (row_buf) storage_store_row(r, h_row, vel_row);
     }
+    free(row_buf);
 }
 
-void simulation_step() {
-    for (int r = 0; r < HEIGHT; r++) {
-        for (int c = 0; c < WIDTH; c++) {
-            if (obstacle[r][c]) {
-                next_h[r][c] = 0.0f;   // Obstacles have no water
-                next_vel[r][c] = 0.0f; // And no velocity
-                continue;
-            }
+void initialize_simulation() {
+    if (G_MAP) map_convert();
+    else fill_default_tank();
 
-            // Get heights of neighbors. If a neighbor is an obstacle,
-            // use the current cell's height for that neighbor (simulates reflection - Neumann boundary).
-            float h_up    = (r > 0          && !obstacle[r-1][c]) ? h[r-1][c] : h[r][c];
-            float h_down  = (r < HEIGHT - 1 && !obstacle[r+1][c]) ? h[r+1][c] : h[r][c];
-            float h_left  = (c > 0          && !obstacle[r][c-1]) ? h[r][c-1] : h[r][c];
-            float h_right = (c < WIDTH - 1  && !obstacle[r][c+1]) ? h[r][c+1] : h[r][c];
+    g_max_vel = 0.0f;
+    g_sim_time = 0.0;
+    g_step_count = 0;
+    build_step_plan();
+}
 
-            // Discrete Laplacian of the height field (measures "curvature")
-            float laplacian_h = (h_up + h_down + h_left + h_right - 4.0f * h[r][c]);
+// --- Interior Span Kernels ---
+// All variants perform exactly the same float operations in the same order, so they
+// produce bit-identical results (the build keeps a*b+c unfused, see Makefile).
+typedef struct {
+    float speed_sq;  // G_WAVE_SPEED_SQ
+    float dt;        // G_DT
+    float damping;   // 1 - G_DAMPING * G_DT
+} kernel_params;
 
-            // Update velocity based on the force from the Laplacian
-            float current_vel = vel[r][c];
-            current_vel += (G_WAVE_SPEED_SQ * laplacian_h) * G_DT;
-            
-            // Apply damping to reduce wave energy over time
-            current_vel *= (1.0f - G_DAMPING * G_DT); 
-            next_vel[r][c] = current_vel;
+// Update columns [c0, c1) of a row whose cells all have four water neighbours.
+// Returns the largest |vel| written (NaNs are ignored), for the adaptive time step.
+typedef float (*span_kernel_fn)(const float *h_above, const float *h_row, const float *h_below,
+                               const float *vel_row, float *next_h_row, float *next_vel_row,
+                               int c0, int c1, const kernel_params *kp);
 
-            // Update height based on the new velocity
-            float current_h = h[r][c];
-            current_h += current_vel * G_DT; // vel is actually next_vel[r][c] after damping
-            
-            // Clamp height: water cannot go below 0 or above 1.0 (max cell capacity)
-            current_h = fmaxf(0.0f, current_h);
-            current_h = fminf(1.0f, current_h); 
-            next_h[r][c] = current_h;
-        }
+static kernel_params current_kernel_params(void) {
+    kernel_params kp;
+    kp.speed_sq = G_WAVE_SPEED_SQ;
+    kp.dt = G_DT;
+    kp.damping = 1.0f - G_DAMPING * G_DT;
+    return kp;
+}
+
+static float span_kernel_scalar(const float *h_above, const float *h_row, const float *h_below,
+                               const float *vel_row, float *next_h_row, float *next_vel_row,
+                               int c0, int c1, const kernel_params *kp) {
+    const float speed_sq = kp->speed_sq, dt = kp->dt, damping = kp->damping;
+    float max_vel = 0.0f;
+    for (int c = c0; c < c1; c++) {
+        float laplacian_h = (h_above[c] + h_below[c] + h_row[c-1] + h_row[c+1] - 4.0f * h_row[c]);
+        float current_vel = vel_row[c];
+        current_vel += (speed_sq * laplacian_h) * dt;
+        current_vel *= damping;
+        next_vel_row[c] = current_vel;
+        max_vel = fmaxf(max_vel, fabsf(current_vel));
+        float current_h = h_row[c] + current_vel * dt;
+        current_h = fmaxf(0.0f, current_h);
+        current_h = fminf(1.0f, current_h);
+        next_h_row[c] = current_h;
     }
+    return max_vel;
+}
 
-    // Swap current and next state buffers by swapping pointers (efficient)
-    float **temp_ptr_h = h;
-    h = next_h;
-    next_h = temp_ptr_h;
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define CFD_X86_SIMD 1
+#include <immintrin.h>
 
-    float **temp_ptr_vel = vel;
-    vel = next_vel;
-    next_vel = temp_ptr_vel;
+// 8 cells per iteration. max_ps(x, 0) returns 0 for NaN x, matching fmaxf(0.0f, x).
+__attribute__((target("avx2")))
+static float span_kernel_avx2(const float *h_above, const float *h_row, const float *h_below,
+                             const float *vel_row, float *next_h_row, float *next_vel_row,
+                             int c0, int c1, const kernel_params *kp) {
+    const __m256 speed_sq = _mm256_set1_ps(kp->speed_sq);
+    const __m256 dt = _mm256_set1_ps(kp->dt);
+    const __m256 damping = _mm256_set1_ps(kp->damping);
+    const __m256 four = _mm256_set1_ps(4.0f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+    __m256 max_vel = zero;
+    int c = c0;
+    for (; c + 8 <= c1; c += 8) {
+        __m256 center = _mm256_loadu_ps(h_row + c);
+        __m256 sum = _mm256_add_ps(_mm256_loadu_ps(h_above + c), _mm256_loadu_ps(h_below + c));
+        sum = _mm256_add_ps(sum, _mm256_loadu_ps(h_row + c - 1));
+        sum = _mm256_add_ps(sum, _mm256_loadu_ps(h_row + c + 1));
+        __m256 laplacian_h = _mm256_sub_ps(sum, _mm256_mul_ps(four, center));
+        __m256 v = _mm256_loadu_ps(vel_row + c);
+        v = _mm256_add_ps(v, _mm256_mul_ps(_mm256_mul_ps(speed_sq, laplacian_h), dt));
+        v = _mm256_mul_ps(v, damping);
+        _mm256_storeu_ps(next_vel_row + c, v);
+        max_vel = _mm256_max_ps(_mm256_and_ps(v, abs_mask), max_vel); // NaN lanes keep max_vel
+        __m256 nh = _mm256_add_ps(center, _mm256_mul_ps(v, dt));
+        nh = _mm256_max_ps(nh, zero);
+        nh = _mm256_min_ps(nh, one);
+        _mm256_storeu_ps(next_h_row + c, nh);
+    }
+    float lanes[8];
+    _mm256_storeu_ps(lanes, max_vel);
+    float tail = span_kernel_scalar(h_above, h_row, h_below, vel_row, next_h_row, next_vel_row, c, c1, kp);
+    for (int i = 0; i < 8; i++) tail = fmaxf(tail, lanes[i]);
+    return tail;
 }
 
-// Convert water height (0.0 to 1.0) to an ASCII character
-char height_to_char(float current_h) {
-    if (current_h > 0.80f) return '@'; 
-    if (current_h > 0.65f) return '#';
-    if (current_h > 0.50f) return '*'; // Approx. initial level if G_INITIAL_WATER_LEVEL is 0.5
-    if (current_h > 0.35f) return '='; 
-    if (current_h > 0.20f) return '-';
-    if (current_h > 0.05f) return '.'; // Shallow
-    return ' '; // Empty or very shallow
+// 16 cells per iteration; the tail uses masked loads/stores instead of a scalar loop
+__attribute__((target("avx512f")))
+static float span_kernel_avx512(const float *h_above, const float *h_row, const float *h_below,
+                               const float *vel_row, float *next_h_row, float *next_vel_row,
+                               int c0, int c1, const kernel_params *kp) {
+    const __m512 speed_sq = _mm512_set1_ps(kp->speed_sq);
+    const __m512 dt = _mm512_set1_ps(kp->dt);
+    const __m512 damping = _mm512_set1_ps(kp->damping);
+    const __m512 four = _mm512_set1_ps(4.0f);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 one = _mm512_set1_ps(1.0f);
+    __m512 max_vel = zero;
+    for (int c = c0; c < c1; c += 16) {
+        __mmask16 m = (c1 - c >= 16) ? (__mmask16)0xFFFF : (__mmask16)((1u << (c1 - c)) - 1);
+        __m512 center = _mm512_maskz_loadu_ps(m, h_row + c);
+        __m512 sum = _mm512_add_ps(_mm512_maskz_loadu_ps(m, h_above + c), _mm512_maskz_loadu_ps(m, h_below + c));
+        sum = _mm512_add_ps(sum, _mm512_maskz_loadu_ps(m, h_row + c - 1));
+        sum = _mm512_add_ps(sum, _mm512_maskz_loadu_ps(m, h_row + c + 1));
+        __m512 laplacian_h = _mm512_sub_ps(sum, _mm512_mul_ps(four, center));
+        __m512 v = _mm512_maskz_loadu_ps(m, vel_row + c);
+        v = _mm512_add_ps(v, _mm512_mul_ps(_mm512_mul_ps(speed_sq, laplacian_h), dt));
+        v = _mm512_mul_ps(v, damping);
+        _mm512_mask_storeu_ps(next_vel_row + c, m, v);
+        max_vel = _mm512_max_ps(_mm512_abs_ps(v), max_vel); // Masked-off lanes are 0; NaN lanes keep max_vel
+        __m512 nh = _mm512_add_ps(center, _mm512_mul_ps(v, dt));
+        nh = _mm512_max_ps(nh, zero);
+        nh = _mm512_min_ps(nh, one);
+        _mm512_mask_storeu_ps(next_h_row + c, m, nh);
+    }
+    return _mm512_reduce_max_ps(max_vel);
 }
+#endif // CFD_X86_SIMD
 
-void display_grid() {
-    CLEAR_SCREEN();
-    // Prepare a buffer for the entire screen content to print in one go (reduces flicker)
-    int buffer_len = (WIDTH + 1) * HEIGHT + 1; // +1 for newline per row, +1 for null terminator
-    char *screen_buffer = (char *)malloc(buffer_len);
-    
-    if (!screen_buffer) { // Fallback to direct printf if buffer allocation fails
-        for (int r = 0; r < HEIGHT; r++) {
-            for (int c = 0; c < WIDTH; c++) {
-                if (obstacle[r][c]) {
-                    printf("X"); // Obstacle character
-                } else {
-                    printf("%c", height_to_char(h[r][c]));
-                }
-            }
-            printf("\n");
-        }
-    } else {
-        char *current_char_ptr = screen_buffer;
-        for (int r = 0; r < HEIGHT; r++) {
-            for (int c = 0; c < WIDTH; c++) {
-                if (obstacle[r][c]) {
-                    *current_char_ptr++ = 'X';
-                } else {
-                    *current_char_ptr++ = height_to_char(h[r][c]);
-                }
-            }
-            *current_char_ptr++ = '\n'; // Newline after each row
-        }
-        *current_char_ptr = '\0'; // Null-terminate the buffer
-        printf("%s", screen_buffer);
-        free(screen_buffer);
+// --- Kernel Dispatch ---
+enum { KERNEL_AUTO, KERNEL_SCALAR, KERNEL_AVX2, KERNEL_AVX512 };
+static const char *const KERNEL_NAMES[] = { "auto", "scalar", "avx2", "avx512" };
+
+int G_KERNEL = KERNEL_AUTO;                          // Requested variant (--kernel)
+span_kernel_fn interior_kernel = span_kernel_scalar; // Variant chosen by select_kernel()
+
+static int kernel_supported(int kernel) {
+    switch (kernel) {
+    case KERNEL_SCALAR: return 1;
+#ifdef CFD_X86_SIMD
+    case KERNEL_AVX2:   return __builtin_cpu_supports("avx2");
+    case KERNEL_AVX512: return __builtin_cpu_supports("avx512f");
+#endif
+    default:            return 0;
     }
-    fflush(stdout); // Ensure output is flushed
 }
 
-int main(int argc, char *argv[]) {
-    // Argument Parsing
-    for (int k = 1; k < argc; ++k) {
-        if (strcmp(argv[k], "--dt") == 0) {
-            if (++k < argc) G_DT = atof(argv[k]); else { print_usage(argv[0]); return 1; }
-        } else if (strcmp(argv[k], "--speed_sq") == 0) {
-            if (++k < argc) G_WAVE_SPEED_SQ = atof(argv[k]); else { print_usage(argv[0]); return 1; }
-        } else if (strcmp(argv[k], "--damping") == 0) {
-            if (++k < argc) G_DAMPING = atof(argv[k]); else { print_usage(argv[0]); return 1; }
-        } else if (strcmp(argv[k], "--level") == 0) {
-            if (++k < argc) G_INITIAL_WATER_LEVEL = atof(argv[k]); else { print_usage(argv[0]); return 1; }
-        } else if (strcmp(argv[k], "--tilt") == 0) {
-            if (++k < argc) G_INITIAL_TILT = atof(argv[k]); else { print_usage(argv[0]); return 1; }
-        } else if (strcmp(argv[k], "--sleep") == 0) {
-            if (++k < argc) G_SLEEP_MS = atoi(argv[k]); else { print_usage(argv[0]); return 1; }
-        } else if (strcmp(argv[k], "-h") == 0 || strcmp(argv[k], "--help") == 0) {
-            print_usage(argv[0]); return 0;
-        } else {
-            fprintf(stderr, "Unknown option: %s\n", argv[k]);
-            print_usage(argv[0]); return 1;
-        }
+// Resolve G_KERNEL against the CPU; returns the variant in use, or -1 if a forced
+// variant is not available on this host
+int select_kernel(void) {
+    int kernel = G_KERNEL;
+    if (kernel == KERNEL_AUTO) {
+        kernel = kernel_supported(KERNEL_AVX512) ? KERNEL_AVX512
+               : kernel_supported(KERNEL_AVX2)   ? KERNEL_AVX2
+               : KERNEL_SCALAR;
+    } else if (!kernel_supported(kernel)) {
+        return -1;
+    }
+    switch (kernel) {
+#ifdef CFD_X86_SIMD
+    case KERNEL_AVX2:   interior_kernel = span_kernel_avx2; break;
+    case KERNEL_AVX512: interior_kernel = span_kernel_avx512; break;
+#endif
+    default:            interior_kernel = span_kernel_scalar; break;
     }
+    return kernel;
+}
 
-    // Validate parsed parameters
-    if (G_DT <= 0) { fprintf(stderr, "Error: dt must be > 0.\n"); return 1; }
-    if (G_WAVE_SPEED_SQ <= 0) { fprintf(stderr, "Error: speed_sq must be > 0.\n"); return 1; }
-    // G_DAMPING * G_DT should ideally be < 1 for stable damping. Here G_DAMPING is the factor.
-    if (G_DAMPING < 0.0f ) { fprintf(stderr, "Error: damping must be >= 0.0.\n"); return 1; }
-    if (G_INITIAL_WATER_LEVEL < 0.0f || G_INITIAL_WATER_LEVEL > 1.0f) { fprintf(stderr, "Error: level must be 0.0-1.0.\n"); return 1; }
-    if (G_INITIAL_TILT < 0.0f || G_INITIAL_TILT > 1.0f) { fprintf(stderr, "Error: tilt must be 0.0-1.0.\n"); return 1; }
-    if (G_SLEEP_MS < 0) { fprintf(stderr, "Error: sleep ms must be >= 0.\n"); return 1; }
+// --- Reduced-Precision Storage ---
+// --storage fp16 | bf16 | fixed16 keeps h and vel in 16 bits, halving the memory and the
+// traffic of the bandwidth-bound step. Rows are widened to fp32 for the kernel and
+// rounded back when stored: fp16 and bf16 round to nearest even. fixed16 holds h,
+// which is clamped to [0, 1], as a 16-bit fraction rounded half-up, and vel as fp16.
+typedef void (*widen_row_fn)(float *dst, const uint16_t *src, int n);
+typedef void (*narrow_row_fn)(uint16_t *dst, const float *src, int n);
 
-    // Check a common stability condition for this explicit finite difference scheme (Courant-Friedrichs-Lewy like)
-    // For a 2D wave equation with 5-point Laplacian, (c*DT/dx)^2 <= 0.5 often applies.
-    // Here, c^2 is G_WAVE_SPEED_SQ, and dx (cell spacing) is implicitly 1.
-    float stability_metric = G_WAVE_SPEED_SQ * G_DT * G_DT;
-    if (stability_metric > 0.5f) {
-        fprintf(stderr, "Warning: Simulation might be unstable!\n");
-        fprintf(stderr, "         (speed_sq * dt^2) = %.3f. For stability, this value should ideally be <= 0.5.\n", stability_metric);
-        fprintf(stderr, "         Consider reducing dt or speed_sq.\n");
+typedef struct {
+    const char *name;
+    widen_row_fn widen_h, widen_vel;
+    narrow_row_fn narrow_h, narrow_vel;
+} storage_codec;
+
+// IEEE binary16 <-> binary32, round to nearest even, subnormals kept
+static inline uint16_t f32_to_f16(float f) {
+    uint32_t x, sign;
+    memcpy(&x, &f, sizeof(x));
+    sign = (x >> 16) & 0x8000u;
+    x &= 0x7FFFFFFFu;
+    if (x >= 0x47800000u) return (uint16_t)(sign | (x > 0x7F800000u ? 0x7E00u : 0x7C00u)); // Inf/NaN or too big
+    if (x < 0x38800000u) {
+        // Result is subnormal: let an fp32 add against 0.5 do the rounding
+        float t;
+        memcpy(&t, &x, sizeof(t));
+        t += 0.5f;
+        memcpy(&x, &t, sizeof(x));
+        return (uint16_t)(sign | (x - 0x3F000000u));
     }
+    x += 0xC8000FFFu + ((x >> 13) & 1u); // Rebias the exponent and round
+    return (uint16_t)(sign | (x >> 13));
+}
 
-    get_terminal_size(&WIDTH, &HEIGHT);
-    if (WIDTH < 10 || HEIGHT < 5) { // Ensure a minimum usable size
-        fprintf(stderr, "Terminal too small. Minimum 10x5 required. Using fallback 20x10.\n");
-        WIDTH = (WIDTH < 10) ? 20 : WIDTH; 
-        HEIGHT = (HEIGHT < 5) ? 10 : HEIGHT;
+static inline float f16_to_f32(uint16_t v) {
+    uint32_t x = (uint32_t)(v & 0x7FFFu) << 13;
+    uint32_t exp = x & 0x0F800000u;
+    float f;
+    x += 0x38000000u;
+    if (exp == 0x0F800000u) {
+        x += 0x38000000u;               // Inf/NaN
+    } else if (exp == 0) {
+        x += 0x00800000u;               // Zero/subnormal: renormalize through an fp32 subtract
+        memcpy(&f, &x, sizeof(f));
+        f -= 6.103515625e-05f;          // 2^-14
+        memcpy(&x, &f, sizeof(x));
     }
-    
-    printf("Terminal: %dx%d. Starting fluid sloshing simulation...\n", WIDTH, HEIGHT);
-    printf("Parameters: DT=%.3f, SpeedSq=%.2f, Damping=%.3f, Level=%.2f, Tilt=%.2f, Sleep=%dms\n",
-           G_DT, G_WAVE_SPEED_SQ, G_DAMPING, G_INITIAL_WATER_LEVEL, G_INITIAL_TILT, G_SLEEP_MS);
-    if (stability_metric > 0.5f) printf("WARNING: POTENTIAL INSTABILITY (see details above)\n");
-    SLEEP_MS(3000); // Give time to read parameters and warnings
+    x |= (uint32_t)(v & 0x8000u) << 16;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
 
-    allocate_grids();
-    initialize_simulation();
+static void widen_f16(float *dst, const uint16_t *src, int n) {
+    for (int i = 0; i < n; i++) dst[i] = f16_to_f32(src[i]);
+}
+
+static void narrow_f16(uint16_t *dst, const float *src, int n) {
+    for (int i = 0; i < n; i++) dst[i] = f32_to_f16(src[i]);
+}
+
+// bfloat16 is the top half of a binary32
+static void widen_bf16(float *dst, const uint16_t *src, int n) {
+    for (int i = 0; i < n; i++) {
+        uint32_t x = (uint32_t)src[i] << 16;
+        memcpy(&dst[i], &x, sizeof(x));
+    }
+}
+
+static inline uint16_t f32_to_bf16(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    if ((x & 0x7FFFFFFFu) > 0x7F800000u) return (uint16_t)((x >> 16) | 0x40u); // Keep NaN quiet
+    return (uint16_t)((x + 0x7FFFu + ((x >> 16) & 1u)) >> 16);
+}
+
+static void narrow_bf16(uint16_t *dst, const float *src, int n) {
+    for (int i = 0; i < n; i++) dst[i] = f32_to_bf16(src[i]);
+}
+
+// Unsigned 16-bit fraction: 0 -> 0.0, 65535 -> 1.0 (NaN stores as 0)
+#define UNORM16_SCALE 65535.0f
+
+static inline uint16_t f32_to_unorm16(float v) {
+    v = v > 0.0f ? v : 0.0f;
+    v = v < 1.0f ? v : 1.0f;
+    return (uint16_t)(int)(v * UNORM16_SCALE + 0.5f);
+}
+
+static void widen_unorm16(float *dst, const uint16_t *src, int n) {
+    for (int i = 0; i < n; i++) dst[i] = (float)src[i] * (1.0f / UNORM16_SCALE);
+}
+
+static void narrow_unorm16(uint16_t *dst, const float *src, int n) {
+    for (int i = 0; i < n; i++) dst[i] = f32_to_unorm16(src[i]);
+}
+
+#ifdef CFD_X86_SIMD
+// Same conversions with the F16C instructions, 8 cells at a time
+__attribute__((target("avx,f16c")))
+static void widen_f16_f16c(float *dst, const uint16_t *src, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(src + i))));
+    for (; i < n; i++) dst[i] = f16_to_f32(src[i]);
+}
+
+__attribute__((target("avx,f16c")))
+static void narrow_f16_f16c(uint16_t *dst, const float *src, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm_storeu_si128((__m128i *)(dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+    }
+    for (; i < n; i++) dst[i] = f32_to_f16(src[i]);
+}
+
+// Pack the low 16 bits of eight 32-bit lanes (each <= 0xFFFF) into one 128-bit store
+__attribute__((target("avx2")))
+static inline void store_u16x8(uint16_t *dst, __m256i v) {
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(v, v), 0x08);
+    _mm_storeu_si128((__m128i *)dst, _mm256_castsi256_si128(packed));
+}
+
+__attribute__((target("avx2")))
+static void widen_bf16_avx2(float *dst, const uint16_t *src, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(src + i)));
+        _mm256_storeu_ps(dst + i, _mm256_castsi256_ps(_mm256_slli_epi32(x, 16)));
+    }
+    widen_bf16(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void narrow_bf16_avx2(uint16_t *dst, const float *src, int n) {
+    const __m256i abs_mask = _mm256_set1_epi32(0x7FFFFFFF), inf = _mm256_set1_epi32(0x7F800000);
+    const __m256i bias = _mm256_set1_epi32(0x7FFF), one = _mm256_set1_epi32(1), quiet = _mm256_set1_epi32(0x40);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_castps_si256(_mm256_loadu_ps(src + i));
+        __m256i hi = _mm256_srli_epi32(x, 16);
+        __m256i rounded = _mm256_srli_epi32(_mm256_add_epi32(x, _mm256_add_epi32(bias, _mm256_and_si256(hi, one))), 16);
+        __m256i is_nan = _mm256_cmpgt_epi32(_mm256_and_si256(x, abs_mask), inf);
+        store_u16x8(dst + i, _mm256_blendv_epi8(rounded, _mm256_or_si256(hi, quiet), is_nan));
+    }
+    narrow_bf16(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void widen_unorm16_avx2(float *dst, const uint16_t *src, int n) {
+    const __m256 scale = _mm256_set1_ps(1.0f / UNORM16_SCALE);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(src + i)));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+    }
+    widen_unorm16(dst + i, src + i, n - i);
+}
+
+// max_ps(v, 0) returns 0 for NaN v, like the scalar version
+__attribute__((target("avx2")))
+static void narrow_unorm16_avx2(uint16_t *dst, const float *src, int n) {
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+    const __m256 scale = _mm256_set1_ps(UNORM16_SCALE), half = _mm256_set1_ps(0.5f);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(src + i), zero), one);
+        store_u16x8(dst + i, _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(v, scale), half)));
+    }
+    narrow_unorm16(dst + i, src + i, n - i);
+}
+#endif // CFD_X86_SIMD
+
+static storage_codec STORAGE_CODECS[] = {
+    { "fp32",    NULL,          NULL,       NULL,           NULL },
+    { "fp16",    widen_f16,     widen_f16,  narrow_f16,     narrow_f16 },
+    { "bf16",    widen_bf16,    widen_bf16, narrow_bf16,    narrow_bf16 },
+    { "fixed16", widen_unorm16, widen_f16,  narrow_unorm16, narrow_f16 },
+};
+
+#define N_STORAGE ((int)(sizeof(STORAGE_CODECS) / sizeof(STORAGE_CODECS[0])))
+
+// Use the F16C/AVX2 conversions unless the scalar kernel was asked for. All variants
+// round identically, so the choice does not change results.
+void select_storage_codec(int kernel) {
+#ifdef CFD_X86_SIMD
+    if (kernel != KERNEL_SCALAR && __builtin_cpu_supports("f16c") && __builtin_cpu_supports("avx")) {
+        STORAGE_CODECS[STORAGE_FP16].widen_h = STORAGE_CODECS[STORAGE_FP16].widen_vel = widen_f16_f16c;
+        STORAGE_CODECS[STORAGE_FP16].narrow_h = STORAGE_CODECS[STORAGE_FP16].narrow_vel = narrow_f16_f16c;
+        STORAGE_CODECS[STORAGE_FIXED16].widen_vel = widen_f16_f16c;
+        STORAGE_CODECS[STORAGE_FIXED16].narrow_vel = narrow_f16_f16c;
+    }
+    if (kernel != KERNEL_SCALAR && __builtin_cpu_supports("avx2")) {
+        STORAGE_CODECS[STORAGE_BF16].widen_h = STORAGE_CODECS[STORAGE_BF16].widen_vel = widen_bf16_avx2;
+        STORAGE_CODECS[STORAGE_BF16].narrow_h = STORAGE_CODECS[STORAGE_BF16].narrow_vel = narrow_bf16_avx2;
+        STORAGE_CODECS[STORAGE_FIXED16].widen_h = widen_unorm16_avx2;
+        STORAGE_CODECS[STORAGE_FIXED16].narrow_h = narrow_unorm16_avx2;
+    }
+#else
+    (void)kernel;
+#endif
+}
+
+// Store one row of fp32 heights and velocities into the 16-bit fields
+void storage_store_row(int r, const float *h_row, const float *vel_row) {
+    const storage_codec *sc = &STORAGE_CODECS[G_STORAGE];
+    sc->narrow_h(GRID_ROW(h16, r), h_row, WIDTH);
+    sc->narrow_vel(GRID_ROW(vel16, r), vel_row, WIDTH);
+}
+
+static grid_f storage_view; // Widened heights for display_grid() (allocated on first use)
+
+// Widen the current heights into an fp32 grid of the same shape (for drawing)
+static void storage_widen_heights(grid_f *dst) {
+    for (int r = 0; r < HEIGHT; r++) STORAGE_CODECS[G_STORAGE].widen_h(GRID_ROW(*dst, r), GRID_ROW(h16, r), WIDTH);
+}
+
+// --- Worker Pool ---
+// Threads are created once by pool_start(). Each pool_run() releases them through a
+// spinning sense-reversing barrier, runs the job on every worker (the calling thread
+// is worker 0) and waits on the same barrier for all of them to finish.
+typedef void (*pool_job_fn)(void *arg, int worker, int n_workers);
+
+#ifdef CFD_THREADS
+typedef struct {
+    atomic_int remaining;  // Threads still to arrive in the current phase
+    atomic_int sense;      // Flipped by the last thread to arrive
+    int count;             // Participating threads
+} spin_barrier;
+
+static struct {
+    int n_workers;
+    pthread_t *threads;
+    spin_barrier barrier;
+    pool_job_fn job;       // Job of the current pool_run() (NULL tells workers to exit)
+    void *arg;
+} pool;
+
+static void barrier_wait(spin_barrier *b, int *local_sense) {
+    int sense = !*local_sense;
+    *local_sense = sense;
+    if (atomic_fetch_sub_explicit(&b->remaining, 1, memory_order_acq_rel) == 1) {
+        atomic_store_explicit(&b->remaining, b->count, memory_order_relaxed);
+        atomic_store_explicit(&b->sense, sense, memory_order_release);
+        return;
+    }
+    // Spin briefly (a step is short), then yield so oversubscribed hosts still progress
+    for (int spins = 0; atomic_load_explicit(&b->sense, memory_order_acquire) != sense; spins++) {
+        if (spins > 4096) sched_yield();
+    }
+}
+
+static void *pool_worker(void *p) {
+    int worker = (int)(ptrdiff_t)p;
+    int local_sense = 0;
+    for (;;) {
+        barrier_wait(&pool.barrier, &local_sense);     // Wait for a job
+        if (!pool.job) break;
+        pool.job(pool.arg, worker, pool.n_workers);
+        barrier_wait(&pool.barrier, &local_sense);     // Report completion
+    }
+    return NULL;
+}
+
+static int pool_main_sense = 0; // Barrier sense of the calling (main) thread
+
+// Start n_workers - 1 helper threads; returns the number of workers actually available
+int pool_start(int n_workers) {
+    pool.n_workers = 1;
+    if (n_workers <= 1) return 1;
+    pool.threads = (pthread_t *)malloc((size_t)n_workers * sizeof(pthread_t));
+    if (!pool.threads) return 1;
+    atomic_store(&pool.barrier.remaining, n_workers);
+    atomic_store(&pool.barrier.sense, 0);
+    pool.barrier.count = n_workers;
+    pool.job = NULL;
+    pool_main_sense = 0;
+    for (int i = 1; i < n_workers; i++) {
+        if (pthread_create(&pool.threads[i], NULL, pool_worker, (void *)(ptrdiff_t)i) != 0) {
+            fprintf(stderr, "Error: could not create worker thread %d.\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+    pool.n_workers = n_workers;
+    return n_workers;
+}
+
+void pool_run(pool_job_fn job, void *arg) {
+    if (pool.n_workers <= 1) { job(arg, 0, 1); return; }
+    pool.job = job;
+    pool.arg = arg;
+    barrier_wait(&pool.barrier, &pool_main_sense);
+    job(arg, 0, pool.n_workers);
+    barrier_wait(&pool.barrier, &pool_main_sense);
+}
+
+int pool_size(void) { return pool.n_workers > 1 ? pool.n_workers : 1; }
 
-    // Main simulation loop
-    while (1) {
-        simulation_step();
-        display_grid();
-        SLEEP_MS(G_SLEEP_MS);
+void pool_stop(void) {
+    if (pool.n_workers <= 1) return;
+    pool.job = NULL;
+    barrier_wait(&pool.barrier, &pool_main_sense);
+    for (int i = 1; i < pool.n_workers; i++) pthread_join(pool.threads[i], NULL);
+    free(pool.threads);
+    pool.threads = NULL;
+    pool.n_workers = 1;
+}
+#else // No threads: every job runs inline on the caller
+int pool_start(int n_workers) { (void)n_workers; return 1; }
+int pool_size(void) { return 1; }
+void pool_run(pool_job_fn job, void *arg) { job(arg, 0, 1); }
+void pool_stop(void) {}
+#endif
+
+// Split [0, n) evenly across workers; worker w gets [*begin, *end)
+static void pool_band(int n, int worker, int n_workers, int *begin, int *end) {
+    *begin = (int)((long long)n * worker / n_workers);
+    *end = (int)((long long)n * (worker + 1) / n_workers);
+}
+
+// Offset to a neighbour if its NB_* bit is set in `mask`, otherwise 0 (the cell itself).
+// Reading the cell itself for a missing neighbour is the Neumann reflection.
+static inline ptrdiff_t neighbor_offset(unsigned char mask, unsigned char bit, ptrdiff_t delta) {
+    return delta & -(ptrdiff_t)((mask & bit) != 0);
+}
+
+// First span of row r that ends after column c_lo (spans are sorted by column)
+static inline int plan_first_span(int r, int c_lo) {
+    int lo = plan.span_start[r], hi = plan.span_start[r + 1];
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (plan.spans[mid].c1 <= c_lo) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+// First edge cell of row r at or after column c_lo
+static inline int plan_first_edge(int r, int c_lo) {
+    int lo = plan.edge_start[r], hi = plan.edge_start[r + 1];
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (plan.edges[mid].c < c_lo) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+// Advance the water cells of row r that lie in columns [c_lo, c_hi). The row pointers
+// hold column `col0` at index 0 and rows are `stride` floats apart, so the same code
+// serves the full grids and the temporal-blocking tile scratch.
+static float step_row_span(int r, int c_lo, int c_hi, int col0, ptrdiff_t stride,
+                          const float *h_row, const float *vel_row,
+                          float *next_h_row, float *next_vel_row, const kernel_params *kp) {
+    const float speed_sq = kp->speed_sq;
+    const float dt = kp->dt;
+    const float damping = kp->damping;
+    float max_vel = 0.0f;
+
+    // Fully interior runs: every neighbour is water, so no tests at all
+    for (int s = plan_first_span(r, c_lo); s < plan.span_start[r + 1] && plan.spans[s].c0 < c_hi; s++) {
+        int c0 = plan.spans[s].c0 > c_lo ? plan.spans[s].c0 : c_lo;
+        int c1 = plan.spans[s].c1 < c_hi ? plan.spans[s].c1 : c_hi;
+        if (c0 < c1) {
+            float span_max = interior_kernel(h_row - stride, h_row, h_row + stride, vel_row,
+                                             next_h_row, next_vel_row, c0 - col0, c1 - col0, kp);
+            max_vel = fmaxf(max_vel, span_max);
+        }
+    }
+
+    // Cells next to walls or the border: a neighbour that is not water reads the
+    // cell's own height (reflection), selected through the precomputed mask
+    for (int e = plan_first_edge(r, c_lo); e < plan.edge_start[r + 1] && plan.edges[e].c < c_hi; e++) {
+        const int c = plan.edges[e].c - col0;
+        const unsigned char m = plan.edges[e].mask;
+        const float *center = h_row + c;
+        float h_up    = center[neighbor_offset(m, NB_UP, -stride)];
+        float h_down  = center[neighbor_offset(m, NB_DOWN, stride)];
+        float h_left  = center[neighbor_offset(m, NB_LEFT, -1)];
+        float h_right = center[neighbor_offset(m, NB_RIGHT, 1)];
+        float laplacian_h = (h_up + h_down + h_left + h_right - 4.0f * *center);
+        float current_vel = vel_row[c];
+        current_vel += (speed_sq * laplacian_h) * dt;
+        current_vel *= damping;
+        next_vel_row[c] = current_vel;
+        max_vel = fmaxf(max_vel, fabsf(current_vel));
+        float current_h = *center + current_vel * dt;
+        current_h = fmaxf(0.0f, current_h);
+        current_h = fminf(1.0f, current_h);
+        next_h_row[c] = current_h;
+    }
+    return max_vel;
+}
+
+// Advance rows [r0, r1) from h/vel into next_h/next_vel; returns their max |vel|
+static float step_rows(int r0, int r1) {
+    const kernel_params kp = current_kernel_params();
+    float max_vel = 0.0f;
+    for (int r = r0; r < r1; r++) {
+        float row_max = step_row_span(r, 0, WIDTH, 0, (ptrdiff_t)h.stride,
+                                      GRID_ROW(h, r), GRID_ROW(vel, r), GRID_ROW(next_h, r), GRID_ROW(next_vel, r), &kp);
+        max_vel = fmaxf(max_vel, row_max);
+    }
+    return max_vel;
+}
+
+// --- Step Monitor ---
+// Every step reports the largest |vel| it wrote. Workers fill their own cache-line
+// slot and simulation_step() folds them into g_max_vel.
+#define MONITOR_SLOT 16 // Floats per worker slot (one cache line)
+
+static float *monitor_slots = NULL;
+static int monitor_n_slots = 0;
+
+static void monitor_reserve(int n_workers) {
+    if (monitor_n_slots >= n_workers) return;
+    aligned_block_free(monitor_slots);
+    monitor_slots = (float *)aligned_block_alloc((size_t)n_workers * MONITOR_SLOT * sizeof(float));
+    if (!monitor_slots) {
+        fprintf(stderr, "Error: Memory allocation failed for step monitor.\n");
+        exit(EXIT_FAILURE);
+    }
+    monitor_n_slots = n_workers;
+}
+
+static void monitor_collect(int n_workers, int steps) {
+    float max_vel = 0.0f;
+    for (int i = 0; i < n_workers; i++) max_vel = fmaxf(max_vel, monitor_slots[i * MONITOR_SLOT]);
+    g_max_vel = max_vel;
+    g_sim_time += (double)steps * G_DT;
+    g_step_count += steps;
+}
+
+void free_monitor(void) {
+    aligned_block_free(monitor_slots);
+    monitor_slots = NULL;
+    monitor_n_slots = 0;
+}
+
+// Pool job: each worker advances its own band of rows
+static void step_job(void *arg, int worker, int n_workers) {
+    int r0, r1;
+    (void)arg;
+    pool_band(HEIGHT, worker, n_workers, &r0, &r1);
+    monitor_slots[worker * MONITOR_SLOT] = step_rows(r0, r1);
+}
+
+// --- Active Tiles ---
+// With --active-tiles the grid is cut into AT_TILE x AT_TILE tiles and only awake tiles
+// are stepped. A stepped tile is active unless all its water cells end the step with
+// |vel| and |laplacian| below --quiescence. Every active tile keeps itself and its eight
+// neighbours awake for the next step (a wave moves one cell per step, so it is always
+// caught before it crosses into a sleeping tile). A tile that falls asleep has its new
+// state copied into the other buffer: both buffers then hold the same frozen cells, and
+// neighbours read the right values whichever way the buffers are swapped.
+#define AT_TILE 32
+
+typedef struct {
+    int width, height;       // Grid the arrays were sized for
+    int tiles_x, tiles_y;
+    unsigned char *awake;    // Tiles stepped this step
+    unsigned char *active;   // Stepped tiles with max |vel| >= --quiescence (written by the workers)
+    unsigned char *wake;     // Scratch: tiles awake next step
+    int *work;               // Indices of the awake tiles
+    int n_work;
+    int valid;               // 0 until sized; cleared by build_step_plan() to wake everything
+    long long stepped;       // Tile steps computed...
+    long long total;         // ...out of tile steps that plain stepping would compute
+} active_tiles;
+
+static active_tiles at;
+
+void active_tiles_invalidate(void) { at.valid = 0; }
+
+void free_active_tiles(void) {
+    free(at.awake); free(at.active); free(at.wake); free(at.work);
+    memset(&at, 0, sizeof(at));
+}
+
+// Size the tile arrays for the current grid and wake every tile
+static void active_tiles_prepare(void) {
+    if (at.valid) return;
+    if (at.width != WIDTH || at.height != HEIGHT || !at.awake) {
+        long long stepped = at.stepped, total = at.total;
+        free_active_tiles();
+        at.width = WIDTH;
+        at.height = HEIGHT;
+        at.tiles_x = (WIDTH + AT_TILE - 1) / AT_TILE;
+        at.tiles_y = (HEIGHT + AT_TILE - 1) / AT_TILE;
+        size_t n = (size_t)at.tiles_x * at.tiles_y;
+        at.awake = (unsigned char *)malloc(n);
+        at.active = (unsigned char *)malloc(n);
+        at.wake = (unsigned char *)malloc(n);
+        at.work = (int *)malloc(n * sizeof(int));
+        if (!at.awake || !at.active || !at.wake || !at.work) {
+            fprintf(stderr, "Error: Memory allocation failed for active tiles.\n");
+            exit(EXIT_FAILURE);
+        }
+        at.stepped = stepped;
+        at.total = total;
+    }
+    memset(at.awake, 1, (size_t)at.tiles_x * at.tiles_y);
+    at.valid = 1;
+}
+
+// Tile t covers rows [*r0, *r1) and columns [*c0, *c1)
+static void at_tile_bounds(int t, int *r0, int *r1, int *c0, int *c1) {
+    *r0 = (t / at.tiles_x) * AT_TILE;
+    *c0 = (t % at.tiles_x) * AT_TILE;
+    *r1 = *r0 + AT_TILE < HEIGHT ? *r0 + AT_TILE : HEIGHT;
+    *c1 = *c0 + AT_TILE < WIDTH ? *c0 + AT_TILE : WIDTH;
+}
+
+// True if every water cell of a tile has |laplacian of next_h| below --quiescence
+// (walls reflect as in the step). Stops at the first cell that is not.
+static int at_tile_flat(int R0, int R1, int C0, int C1) {
+    const ptrdiff_t stride = (ptrdiff_t)next_h.stride;
+    for (int r = R0; r < R1; r++) {
+        const float *row = GRID_ROW(next_h, r);
+        for (int s = plan_first_span(r, C0); s < plan.span_start[r + 1] && plan.spans[s].c0 < C1; s++) {
+            int c0 = plan.spans[s].c0 > C0 ? plan.spans[s].c0 : C0;
+            int c1 = plan.spans[s].c1 < C1 ? plan.spans[s].c1 : C1;
+            for (int c = c0; c < c1; c++) {
+                float lap = row[c - stride] + row[c + stride] + row[c - 1] + row[c + 1] - 4.0f * row[c];
+                if (!(fabsf(lap) < G_QUIESCENCE)) return 0;
+            }
+        }
+        for (int e = plan_first_edge(r, C0); e < plan.edge_start[r + 1] && plan.edges[e].c < C1; e++) {
+            const float *center = row + plan.edges[e].c;
+            const unsigned char m = plan.edges[e].mask;
+            float lap = center[neighbor_offset(m, NB_UP, -stride)] + center[neighbor_offset(m, NB_DOWN, stride)]
+                      + center[neighbor_offset(m, NB_LEFT, -1)] + center[neighbor_offset(m, NB_RIGHT, 1)]
+                      - 4.0f * *center;
+            if (!(fabsf(lap) < G_QUIESCENCE)) return 0;
+        }
+    }
+    return 1;
+}
+
+// Mark tile t and its eight neighbours awake for the next step
+static void at_wake_around(int t) {
+    int ty = t / at.tiles_x, tx = t % at.tiles_x;
+    for (int y = ty - 1; y <= ty + 1; y++) {
+        for (int x = tx - 1; x <= tx + 1; x++) {
+            if (y >= 0 && y < at.tiles_y && x >= 0 && x < at.tiles_x) at.wake[y * at.tiles_x + x] = 1;
+        }
+    }
+}
+
+// Pool job: awake tiles are dealt out round-robin
+static void at_job(void *arg, int worker, int n_workers) {
+    const kernel_params kp = current_kernel_params();
+    float max_vel = 0.0f;
+    (void)arg;
+    for (int i = worker; i < at.n_work; i += n_workers) {
+        int t = at.work[i], R0, R1, C0, C1;
+        at_tile_bounds(t, &R0, &R1, &C0, &C1);
+        float tile_max = 0.0f;
+        for (int r = R0; r < R1; r++) {
+            float row_max = step_row_span(r, C0, C1, 0, (ptrdiff_t)h.stride, GRID_ROW(h, r), GRID_ROW(vel, r),
+                                          GRID_ROW(next_h, r), GRID_ROW(next_vel, r), &kp);
+            tile_max = fmaxf(tile_max, row_max);
+        }
+        // Written as "not below" so a NaN keeps the tile awake
+        at.active[t] = !(tile_max < G_QUIESCENCE);
+        max_vel = fmaxf(max_vel, tile_max);
+    }
+    monitor_slots[worker * MONITOR_SLOT] = max_vel;
+}
+
+// One step of the awake tiles; leaves the grids swapped like simulation_step()
+static void active_tiles_step(void) {
+    const int n_tiles = at.tiles_x * at.tiles_y;
+    at.n_work = 0;
+    for (int t = 0; t < n_tiles; t++) {
+        if (at.awake[t]) at.work[at.n_work++] = t;
+    }
+    monitor_reserve(pool_size());
+    pool_run(at_job, NULL);
+    monitor_collect(pool_size(), 1);
+
+    // Next step's awake set: every tile with moving water and its neighbours...
+    memset(at.wake, 0, (size_t)n_tiles);
+    for (int i = 0; i < at.n_work; i++) {
+        if (at.active[at.work[i]]) at_wake_around(at.work[i]);
+    }
+    // ...plus the still tiles that are not flat yet. Only tiles that would otherwise
+    // fall asleep need the laplacian, which keeps the scan to the edge of the awake region.
+    for (int i = 0; i < at.n_work; i++) {
+        int t = at.work[i], R0, R1, C0, C1;
+        if (at.wake[t]) continue;
+        at_tile_bounds(t, &R0, &R1, &C0, &C1);
+        if (!at_tile_flat(R0, R1, C0, C1)) at_wake_around(t);
+    }
+
+    // Tiles falling asleep: make both buffers hold the state just computed
+    for (int i = 0; i < at.n_work; i++) {
+        int t = at.work[i], R0, R1, C0, C1;
+        if (at.wake[t]) continue;
+        at_tile_bounds(t, &R0, &R1, &C0, &C1);
+        size_t bytes = (size_t)(C1 - C0) * sizeof(float);
+        for (int r = R0; r < R1; r++) {
+            memcpy(GRID_ROW(h, r) + C0, GRID_ROW(next_h, r) + C0, bytes);
+            memcpy(GRID_ROW(vel, r) + C0, GRID_ROW(next_vel, r) + C0, bytes);
+        }
+    }
+
+    unsigned char *tmp = at.awake;
+    at.awake = at.wake;
+    at.wake = tmp;
+    at.stepped += at.n_work;
+    at.total += n_tiles;
+}
+
+// --- 16-bit Stepping ---
+// Each worker walks its band in chunks of ST_CHUNK_ROWS rows: the chunk's h rows plus
+// one halo row above and below, and its vel rows, are widened into fp32 scratch, stepped
+// there by step_row_span() and rounded back into next_h16/next_vel16.
+#define ST_CHUNK_ROWS 8
+
+static float *st_scratch = NULL;  // Per-worker scratch, st_worker_floats each
+static size_t st_worker_floats = 0;
+static size_t st_stride = 0;      // Floats between scratch rows
+static int st_n_workers = 0;
+
+void free_storage(void) {
+    grid_f_free(&storage_view);
+    aligned_block_free(st_scratch);
+    st_scratch = NULL;
+    st_worker_floats = 0;
+    st_n_workers = 0;
+}
+
+static void storage_reserve(int n_workers) {
+    size_t stride = grid_stride(WIDTH, sizeof(float));
+    if (st_n_workers >= n_workers && st_stride == stride) return;
+    free_storage();
+    st_stride = stride;
+    st_worker_floats = (size_t)(4 * ST_CHUNK_ROWS + 2) * stride; // h (with halos), vel, next_h, next_vel
+    st_scratch = (float *)aligned_block_alloc((size_t)n_workers * st_worker_floats * sizeof(float));
+    if (!st_scratch) {
+        fprintf(stderr, "Error: Memory allocation failed for storage scratch.\n");
+        exit(EXIT_FAILURE);
+    }
+    st_n_workers = n_workers;
+}
+
+// Pool job: each worker advances its own band of rows
+static void storage_step_job(void *arg, int worker, int n_workers) {
+    const kernel_params kp = current_kernel_params();
+    const storage_codec *sc = &STORAGE_CODECS[G_STORAGE];
+    const size_t ss = st_stride;
+    float *hs = st_scratch + (size_t)worker * st_worker_floats; // Scratch row 0 is the halo above
+    float *vs = hs + (ST_CHUNK_ROWS + 2) * ss;
+    float *nhs = vs + ST_CHUNK_ROWS * ss;
+    float *nvs = nhs + ST_CHUNK_ROWS * ss;
+    float max_vel = 0.0f;
+    int r0, r1;
+    (void)arg;
+    pool_band(HEIGHT, worker, n_workers, &r0, &r1);
+    for (int q0 = r0; q0 < r1; q0 += ST_CHUNK_ROWS) {
+        int q1 = q0 + ST_CHUNK_ROWS < r1 ? q0 + ST_CHUNK_ROWS : r1;
+        for (int r = q0 - 1; r <= q1; r++) {
+            if (r >= 0 && r < HEIGHT) sc->widen_h(hs + (size_t)(r - q0 + 1) * ss, GRID_ROW(h16, r), WIDTH);
+        }
+        for (int r = q0; r < q1; r++) sc->widen_vel(vs + (size_t)(r - q0) * ss, GRID_ROW(vel16, r), WIDTH);
+        // Walls are never written by the step and must come out as 0
+        memset(nhs, 0, (size_t)(q1 - q0) * ss * sizeof(float));
+        memset(nvs, 0, (size_t)(q1 - q0) * ss * sizeof(float));
+        for (int r = q0; r < q1; r++) {
+            size_t off = (size_t)(r - q0) * ss;
+            float row_max = step_row_span(r, 0, WIDTH, 0, (ptrdiff_t)ss, hs + off + ss, vs + off,
+                                          nhs + off, nvs + off, &kp);
+            max_vel = fmaxf(max_vel, row_max);
+        }
+        for (int r = q0; r < q1; r++) {
+            size_t off = (size_t)(r - q0) * ss;
+            sc->narrow_h(GRID_ROW(next_h16, r), nhs + off, WIDTH);
+            sc->narrow_vel(GRID_ROW(next_vel16, r), nvs + off, WIDTH);
+        }
+    }
+    monitor_slots[worker * MONITOR_SLOT] = max_vel;
+}
+
+static void storage_step(void) {
+    storage_reserve(pool_size());
+    monitor_reserve(pool_size());
+    pool_run(storage_step_job, NULL);
+    monitor_collect(pool_size(), 1);
+    grid_u16_swap(&h16, &next_h16);
+    grid_u16_swap(&vel16, &next_vel16);
+}
+
+// --- Implicit Integrator ---
+// With --integrator implicit each step is the Crank-Nicolson (implicit midpoint) rule
+// instead of the explicit update. Eliminating vel' leaves one Helmholtz-type system:
+//   (I - a L) h' = h + dt * vel / k + a L h,   k = 1 + damping * dt / 2,  a = speed_sq * dt^2 / (4 k)
+//   vel' = 2 (h' - h) / dt - vel,   then h' is clamped to [0, 1] as in the explicit step
+// L is the explicit step's laplacian (walls reflect: they read as the cell's own h).
+// The rule is stable for any dt and only loses energy to --damping, so stiff settings
+// can take steps far beyond the explicit limit. The system is symmetric positive
+// definite and solved by conjugate gradients until the residual is --cg-tol times that
+// of leaving h unchanged, preconditioned by one multigrid V-cycle: damped Jacobi
+// smoothing on a hierarchy built by merging 2x2 blocks, so every level sees the walls
+// as missing couplings. A block's mass is the sum of its cells; the couplings across
+// a block border are summed and halved (the 5-point stencil at twice the spacing;
+// the plain sum overweights them and needs several times the CG iterations).
+//
+// Level 0 is the grid itself and walks the step plan like the explicit step. Coarser
+// levels apply A x_i = m_i x_i + sum_j w_ij (x_i - x_j) from stored per-cell mass m and
+// couplings to the right (wr) and below (wd).
+#define IG_MAX_LEVELS 16
+#define IG_MAX_ITER 200         // CG iterations per step at most
+#define IG_OMEGA 0.8f           // Jacobi damping
+#define IG_SMOOTH 2             // Sweeps before and after the coarse correction (even)
+#define IG_COARSE_SWEEPS 16     // Sweeps on a coarsest level that is still stiff (even)
+#define IG_COARSE_COUPLING 0.5f // Weight of the summed couplings across a block border
+#define IG_EASY 0.05f           // Coarsening stops once coupling / mass falls below this
+                                // (Jacobi alone then converges fast)
+#define IG_SERIAL_CELLS 16384   // Levels smaller than this run on the calling thread
+#define IG_SLOT 8               // Doubles per worker partial-sum slot (one cache line)
+
+enum { INTEGRATOR_EXPLICIT, INTEGRATOR_IMPLICIT, INTEGRATOR_SPECTRAL }; // Spectral: see Spectral Propagator
+static const char *const INTEGRATOR_NAMES[] = { "explicit", "implicit", "spectral" };
+
+typedef struct {
+    int w, h;
+    grid_f m, wr, wd, inv_d;  // Operator: mass, couplings right and down, 1 / diagonal (not on level 0)
+    grid_f x, t, b;           // Solution, smoother scratch, right-hand side (level 0: x = z, b = r)
+} ig_level;
+
+static struct {
+    int width, height;        // Grid the hierarchy was built for
+    float a;                  // Coupling it was built with
+    float inv_d0[5];          // Level 0: 1 / diagonal of a water cell by its number of water neighbours
+    int valid;                // 0 until built; cleared by build_step_plan()
+    long long solves, iterations, capped; // Steps, CG iterations, steps that hit IG_MAX_ITER
+    int n_levels;
+    int coarse_sweeps;        // Sweeps on the coarsest level
+    ig_level lv[IG_MAX_LEVELS];
+    grid_f r, z, p, q;        // CG vectors; the iterate lives in next_h
+    float *scratch;           // Per-worker row of A x
+    double *partial;          // Per-worker partial sums, IG_SLOT each
+    int n_workers;            // Workers the scratch is sized for
+    int parts;                // Workers that ran the last job (slots holding its sums)
+    int max_iterations;
+} ig;
+
+typedef struct {
+    int level;
+    const grid_f *src;        // Smoother input...
+    grid_f *dst;              // ...and output
+    int zero;                 // Smoother: src is all zero
+    float coef;               // Step size of the job (alpha, beta, 2 / dt)
+    float scale;              // Right-hand side: dt / k
+} ig_task;
+
+// New walls or a restarted run: rebuild before the next step and restart the statistics
+void implicit_invalidate(void) {
+    ig.valid = 0;
+    ig.solves = ig.iterations = ig.capped = 0;
+    ig.max_iterations = 0;
+}
+
+// Level-0 stencil over columns [c0, c1) of fully interior cells: out = A x, or with b
+// given, one Jacobi sweep out = x + w (b - A x). Variants do the same float operations
+// in the same order, like the step's span kernels.
+typedef void (*ig_span_fn)(const float *x_above, const float *x_row, const float *x_below,
+                           const float *b, float *out, int c0, int c1, float a, float w);
+
+static void ig_span_scalar(const float *x_above, const float *x_row, const float *x_below,
+                           const float *b, float *out, int c0, int c1, float a, float w) {
+    for (int c = c0; c < c1; c++) {
+        float lap = x_above[c] + x_below[c] + x_row[c - 1] + x_row[c + 1] - 4.0f * x_row[c];
+        float ax = x_row[c] - a * lap;
+        out[c] = b ? x_row[c] + w * (b[c] - ax) : ax;
+    }
+}
+
+#ifdef CFD_X86_SIMD
+__attribute__((target("avx2")))
+static void ig_span_avx2(const float *x_above, const float *x_row, const float *x_below,
+                         const float *b, float *out, int c0, int c1, float a, float w) {
+    const __m256 va = _mm256_set1_ps(a), vw = _mm256_set1_ps(w), four = _mm256_set1_ps(4.0f);
+    int c = c0;
+    for (; c + 8 <= c1; c += 8) {
+        __m256 center = _mm256_loadu_ps(x_row + c);
+        __m256 sum = _mm256_add_ps(_mm256_loadu_ps(x_above + c), _mm256_loadu_ps(x_below + c));
+        sum = _mm256_add_ps(sum, _mm256_loadu_ps(x_row + c - 1));
+        sum = _mm256_add_ps(sum, _mm256_loadu_ps(x_row + c + 1));
+        __m256 lap = _mm256_sub_ps(sum, _mm256_mul_ps(four, center));
+        __m256 ax = _mm256_sub_ps(center, _mm256_mul_ps(va, lap));
+        if (b) ax = _mm256_add_ps(center, _mm256_mul_ps(vw, _mm256_sub_ps(_mm256_loadu_ps(b + c), ax)));
+        _mm256_storeu_ps(out + c, ax);
+    }
+    ig_span_scalar(x_above, x_row, x_below, b, out, c, c1, a, w);
+}
+#endif
+
+// Coarse-level stencil over columns [c0, c1) of row `xr` (c0 > 0, c1 < width): out = A x
+// from mass m, couplings wr (right), wd (down) and wu (the row above's wd); or with b
+// given, one Jacobi sweep out = x + w inv_d (b - A x).
+typedef void (*ig_coarse_fn)(const float *m, const float *wr, const float *wd, const float *wu,
+                             const float *xu, const float *xr, const float *xd,
+                             const float *b, const float *inv_d, float *out, int c0, int c1, float w);
+
+static inline float ig_coarse_cell(float m, float x, float wd, float xd, float wu, float xu,
+                                   float wr, float x_right, float wl, float x_left) {
+    return m * x + wd * (x - xd) + wu * (x - xu) + wr * (x - x_right) + wl * (x - x_left);
+}
+
+static void ig_coarse_scalar(const float *m, const float *wr, const float *wd, const float *wu,
+                             const float *xu, const float *xr, const float *xd,
+                             const float *b, const float *inv_d, float *out, int c0, int c1, float w) {
+    for (int c = c0; c < c1; c++) {
+        float ax = ig_coarse_cell(m[c], xr[c], wd[c], xd[c], wu[c], xu[c], wr[c], xr[c + 1], wr[c - 1], xr[c - 1]);
+        out[c] = b ? xr[c] + w * inv_d[c] * (b[c] - ax) : ax;
+    }
+}
+
+#ifdef CFD_X86_SIMD
+__attribute__((target("avx2")))
+static void ig_coarse_avx2(const float *m, const float *wr, const float *wd, const float *wu,
+                           const float *xu, const float *xr, const float *xd,
+                           const float *b, const float *inv_d, float *out, int c0, int c1, float w) {
+    const __m256 vw = _mm256_set1_ps(w);
+    int c = c0;
+    for (; c + 8 <= c1; c += 8) {
+        __m256 x = _mm256_loadu_ps(xr + c);
+        __m256 ax = _mm256_mul_ps(_mm256_loadu_ps(m + c), x);
+        ax = _mm256_add_ps(ax, _mm256_mul_ps(_mm256_loadu_ps(wd + c), _mm256_sub_ps(x, _mm256_loadu_ps(xd + c))));
+        ax = _mm256_add_ps(ax, _mm256_mul_ps(_mm256_loadu_ps(wu + c), _mm256_sub_ps(x, _mm256_loadu_ps(xu + c))));
+        ax = _mm256_add_ps(ax, _mm256_mul_ps(_mm256_loadu_ps(wr + c), _mm256_sub_ps(x, _mm256_loadu_ps(xr + c + 1))));
+        ax = _mm256_add_ps(ax, _mm256_mul_ps(_mm256_loadu_ps(wr + c - 1), _mm256_sub_ps(x, _mm256_loadu_ps(xr + c - 1))));
+        if (b) {
+            __m256 step = _mm256_mul_ps(_mm256_mul_ps(vw, _mm256_loadu_ps(inv_d + c)), _mm256_sub_ps(_mm256_loadu_ps(b + c), ax));
+            ax = _mm256_add_ps(x, step);
+        }
+        _mm256_storeu_ps(out + c, ax);
+    }
+    ig_coarse_scalar(m, wr, wd, wu, xu, xr, xd, b, inv_d, out, c, c1, w);
+}
+#endif
+
+static ig_span_fn ig_span = ig_span_scalar;
+static ig_coarse_fn ig_coarse = ig_coarse_scalar;
+
+void select_implicit_kernel(int kernel) {
+#ifdef CFD_X86_SIMD
+    if (kernel != KERNEL_SCALAR && __builtin_cpu_supports("avx2")) {
+        ig_span = ig_span_avx2;
+        ig_coarse = ig_coarse_avx2;
+    }
+#else
+    (void)kernel;
+#endif
+}
+
+static void ig_free_levels(void) {
+    for (int l = 0; l < ig.n_levels; l++) {
+        ig_level *lv = &ig.lv[l];
+        grid_f_free(&lv->m); grid_f_free(&lv->wr); grid_f_free(&lv->wd); grid_f_free(&lv->inv_d);
+        grid_f_free(&lv->t);
+        if (l > 0) { grid_f_free(&lv->x); grid_f_free(&lv->b); }
+    }
+    grid_f_free(&ig.r); grid_f_free(&ig.z); grid_f_free(&ig.p); grid_f_free(&ig.q);
+    ig.n_levels = 0;
+    ig.valid = 0;
+}
+
+void free_implicit(void) {
+    ig_free_levels();
+    aligned_block_free(ig.scratch);
+    aligned_block_free(ig.partial);
+    memset(&ig, 0, sizeof(ig));
+}
+
+// Row r of A x on level 0, through the step plan. A missing neighbour reads as the cell
+// itself, as in the explicit step. Walls get 0.
+static void ig_row_ax0(const grid_f *x, int r, float *ax) {
+    const float a = ig.a;
+    const ptrdiff_t stride = (ptrdiff_t)x->stride;
+    const float *xr = GRID_ROW(*x, r);
+    memset(ax, 0, (size_t)WIDTH * sizeof(float));
+    for (int s = plan.span_start[r]; s < plan.span_start[r + 1]; s++) {
+        ig_span(xr - stride, xr, xr + stride, NULL, ax, plan.spans[s].c0, plan.spans[s].c1, a, 0.0f);
+    }
+    for (int e = plan.edge_start[r]; e < plan.edge_start[r + 1]; e++) {
+        const unsigned char m = plan.edges[e].mask;
+        const float *center = xr + plan.edges[e].c;
+        float lap = center[neighbor_offset(m, NB_UP, -stride)] + center[neighbor_offset(m, NB_DOWN, stride)]
+                  + center[neighbor_offset(m, NB_LEFT, -1)] + center[neighbor_offset(m, NB_RIGHT, 1)] - 4.0f * *center;
+        ax[plan.edges[e].c] = *center - a * lap;
+    }
+}
+
+// Row r of A x on a coarse level, or with b given one Jacobi sweep into out (see
+// ig_coarse_fn). Missing neighbour rows and columns read as the cell itself (a zero
+// term: their couplings are 0 anyway).
+static void ig_coarse_row(const ig_level *lv, const grid_f *x, int r, const float *b, float *out) {
+    const int w = lv->w;
+    const float *xr = GRID_ROW(*x, r);
+    const float *xu = r > 0 ? GRID_ROW(*x, r - 1) : xr;
+    const float *xd = r + 1 < lv->h ? GRID_ROW(*x, r + 1) : xr;
+    const float *m = GRID_ROW(lv->m, r), *wr = GRID_ROW(lv->wr, r), *wd = GRID_ROW(lv->wd, r);
+    const float *wu = r > 0 ? GRID_ROW(lv->wd, r - 1) : wd;
+    const float *inv_d = GRID_ROW(lv->inv_d, r);
+    // First and last column (coarse levels are at least 2 wide) have one horizontal neighbour
+    float ax = ig_coarse_cell(m[0], xr[0], wd[0], xd[0], wu[0], xu[0], wr[0], xr[1], 0.0f, xr[0]);
+    out[0] = b ? xr[0] + IG_OMEGA * inv_d[0] * (b[0] - ax) : ax;
+    ax = ig_coarse_cell(m[w - 1], xr[w - 1], wd[w - 1], xd[w - 1], wu[w - 1], xu[w - 1],
+                        0.0f, xr[w - 1], wr[w - 2], xr[w - 2]);
+    out[w - 1] = b ? xr[w - 1] + IG_OMEGA * inv_d[w - 1] * (b[w - 1] - ax) : ax;
+    ig_coarse(m, wr, wd, wu, xu, xr, xd, b, inv_d, out, 1, w - 1, IG_OMEGA);
+}
+
+// Row r of A x on any level
+static void ig_row_ax(int level, const grid_f *x, int r, float *ax) {
+    if (level == 0) ig_row_ax0(x, r, ax);
+    else ig_coarse_row(&ig.lv[level], x, r, NULL, ax);
+}
+
+// 1 / diagonal of every cell of a coarse level whose m, wr and wd are filled in
+static void ig_fill_inv_diag(ig_level *lv) {
+    for (int r = 0; r < lv->h; r++) {
+        const float *m = GRID_ROW(lv->m, r), *wr = GRID_ROW(lv->wr, r), *wd = GRID_ROW(lv->wd, r);
+        const float *wu = r > 0 ? GRID_ROW(lv->wd, r - 1) : NULL;
+        float *inv_d = GRID_ROW(lv->inv_d, r);
+        for (int c = 0; c < lv->w; c++) {
+            float d = m[c] + wr[c] + wd[c] + (c > 0 ? wr[c - 1] : 0.0f) + (wu ? wu[c] : 0.0f);
+            inv_d[c] = d > 0.0f ? 1.0f / d : 0.0f;
+        }
+    }
+}
+
+// Build the hierarchy for coupling a. Level 1 sums the 2x2 blocks of the grid (m = water
+// cells, couplings = IG_COARSE_COUPLING * a per water-water pair across the block border;
+// pairs inside a block drop out), and every further level merges the one below the same way.
+static void ig_build(float a) {
+    ig_free_levels();
+    ig.a = a;
+    for (int n = 0; n <= 4; n++) ig.inv_d0[n] = 1.0f / (1.0f + a * (float)n);
+
+    int ok = grid_f_alloc(&ig.r, WIDTH, HEIGHT);
+    ok = grid_f_alloc(&ig.z, WIDTH, HEIGHT) && ok;
+    ok = grid_f_alloc(&ig.p, WIDTH, HEIGHT) && ok;
+    ok = grid_f_alloc(&ig.q, WIDTH, HEIGHT) && ok;
+    float ratio = a; // Coupling / mass of the current level
+    int w = WIDTH, h = HEIGHT;
+    while (ok) {
+        ig_level *lv = &ig.lv[ig.n_levels++];
+        lv->w = w;
+        lv->h = h;
+        ok = grid_f_alloc(&lv->t, w, h) && ok;
+        if (ig.n_levels == 1) {
+            lv->x = ig.z;
+            lv->b = ig.r;
+        } else {
+            ok = grid_f_alloc(&lv->m, w, h) && ok;
+            ok = grid_f_alloc(&lv->wr, w, h) && ok;
+            ok = grid_f_alloc(&lv->wd, w, h) && ok;
+            ok = grid_f_alloc(&lv->inv_d, w, h) && ok;
+            ok = grid_f_alloc(&lv->x, w, h) && ok;
+            ok = grid_f_alloc(&lv->b, w, h) && ok;
+        }
+        if (ratio <= IG_EASY) {
+            ig.coarse_sweeps = IG_SMOOTH;
+            break;
+        }
+        if (ig.n_levels == IG_MAX_LEVELS || w <= 2 || h <= 2) {
+            ig.coarse_sweeps = IG_COARSE_SWEEPS;
+            break;
+        }
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+        ratio *= 0.5f * IG_COARSE_COUPLING; // Couplings per border double, mass quadruples
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: Memory allocation failed for the implicit solver.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (ig.n_levels > 1) {
+        ig_level *lv = &ig.lv[1];
+        for (int r = 0; r < HEIGHT; r++) {
+            float *m = GRID_ROW(lv->m, r >> 1), *wr = GRID_ROW(lv->wr, r >> 1), *wd = GRID_ROW(lv->wd, r >> 1);
+            for (int c = 0; c < WIDTH; c++) {
+                if (BITS_AT(obstacle, r, c)) continue;
+                unsigned char nb = neighbor_mask(r, c);
+                m[c >> 1] += 1.0f;
+                if ((c & 1) && (nb & NB_RIGHT)) wr[c >> 1] += IG_COARSE_COUPLING * a;
+                if ((r & 1) && (nb & NB_DOWN)) wd[c >> 1] += IG_COARSE_COUPLING * a;
+            }
+        }
+        ig_fill_inv_diag(lv);
+    }
+    for (int l = 2; l < ig.n_levels; l++) {
+        const ig_level *f = &ig.lv[l - 1];
+        ig_level *lv = &ig.lv[l];
+        for (int r = 0; r < f->h; r++) {
+            const float *fm = GRID_ROW(f->m, r), *fwr = GRID_ROW(f->wr, r), *fwd = GRID_ROW(f->wd, r);
+            float *m = GRID_ROW(lv->m, r >> 1), *wr = GRID_ROW(lv->wr, r >> 1), *wd = GRID_ROW(lv->wd, r >> 1);
+            for (int c = 0; c < f->w; c++) {
+                m[c >> 1] += fm[c];
+                if (c & 1) wr[c >> 1] += IG_COARSE_COUPLING * fwr[c];
+                if (r & 1) wd[c >> 1] += IG_COARSE_COUPLING * fwd[c];
+            }
+        }
+        ig_fill_inv_diag(lv);
+    }
+    ig.width = WIDTH;
+    ig.height = HEIGHT;
+    ig.valid = 1;
+}
+
+// Rebuild the hierarchy if the walls, grid or coupling changed; size per-worker scratch
+static void ig_prepare(float a) {
+    if (!ig.valid || ig.width != WIDTH || ig.height != HEIGHT || ig.a != a) ig_build(a);
+    int n_workers = pool_size();
+    if (ig.n_workers < n_workers) {
+        aligned_block_free(ig.scratch);
+        aligned_block_free(ig.partial);
+        ig.scratch = (float *)aligned_block_alloc((size_t)n_workers * ig.lv[0].t.stride * sizeof(float));
+        ig.partial = (double *)aligned_block_alloc((size_t)n_workers * IG_SLOT * sizeof(double));
+        if (!ig.scratch || !ig.partial) {
+            fprintf(stderr, "Error: Memory allocation failed for the implicit solver.\n");
+            exit(EXIT_FAILURE);
+        }
+        ig.n_workers = n_workers;
+    }
+}
+
+// Run a job over `level`: small levels on the calling thread, the rest on the pool
+static void ig_run(pool_job_fn job, ig_task *task, int level) {
+    const ig_level *lv = &ig.lv[level];
+    if ((long long)lv->w * lv->h < IG_SERIAL_CELLS) {
+        job(task, 0, 1);
+        ig.parts = 1;
+    } else {
+        pool_run(job, task);
+        ig.parts = pool_size();
+    }
+}
+
+// Sum of the partial sums the last job left in its workers' slots
+static double ig_sum(void) {
+    double s = 0.0;
+    for (int i = 0; i < ig.parts; i++) s += ig.partial[i * IG_SLOT];
+    return s;
+}
+
+static float *ig_scratch(int worker) { return ig.scratch + (size_t)worker * ig.lv[0].t.stride; }
+
+// x.y of n floats in double, over four accumulators so the adds do not form one chain
+static double ig_dot(const float *x, const float *y, int n) {
+    double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+    int c = 0;
+    for (; c + 4 <= n; c += 4) {
+        s0 += (double)x[c] * y[c];
+        s1 += (double)x[c + 1] * y[c + 1];
+        s2 += (double)x[c + 2] * y[c + 2];
+        s3 += (double)x[c + 3] * y[c + 3];
+    }
+    for (; c < n; c++) s0 += (double)x[c] * y[c];
+    return (s0 + s1) + (s2 + s3);
+}
+
+// r = b = h + dt * vel / k + a L h and the first iterate next_h = h + dt * vel (both 0 on
+// walls). Sums |b - A h|^2, the residual of leaving h unchanged.
+static void ig_rhs_job(void *arg, int worker, int n_workers) {
+    const ig_task *t = (const ig_task *)arg;
+    float *ax = ig_scratch(worker);
+    double dd = 0.0;
+    int r0, r1;
+    pool_band(HEIGHT, worker, n_workers, &r0, &r1);
+    for (int r = r0; r < r1; r++) {
+        const float *h_row = GRID_ROW(h, r), *vel_row = GRID_ROW(vel, r);
+        float *b = GRID_ROW(ig.r, r), *x = GRID_ROW(next_h, r);
+        ig_row_ax0(&h, r, ax);
+        for (int c = 0; c < WIDTH; c++) {
+            b[c] = 2.0f * h_row[c] - ax[c] + t->scale * vel_row[c]; // a L h = h - A h
+            x[c] = h_row[c] + t->coef * vel_row[c];
+            ax[c] = b[c] - ax[c];
+        }
+        dd += ig_dot(ax, ax, WIDTH);
+    }
+    ig.partial[worker * IG_SLOT] = dd;
+}
+
+// r -= A next_h; sums |r|^2
+static void ig_residual_job(void *arg, int worker, int n_workers) {
+    float *ax = ig_scratch(worker);
+    double rr = 0.0;
+    int r0, r1;
+    (void)arg;
+    pool_band(HEIGHT, worker, n_workers, &r0, &r1);
+    for (int r = r0; r < r1; r++) {
+        float *res = GRID_ROW(ig.r, r);
+        ig_row_ax0(&next_h, r, ax);
+        for (int c = 0; c < WIDTH; c++) res[c] -= ax[c];
+        rr += ig_dot(res, res, WIDTH);
+    }
+    ig.partial[worker * IG_SLOT] = rr;
+}
+
+// p = z + beta p
+static void ig_direction_job(void *arg, int worker, int n_workers) {
+    const ig_task *t = (const ig_task *)arg;
+    int r0, r1;
+    pool_band(HEIGHT, worker, n_workers, &r0, &r1);
+    for (int r = r0; r < r1; r++) {
+        const float *z = GRID_ROW(ig.z, r);
+        float *p = GRID_ROW(ig.p, r);
+        for (int c = 0; c < WIDTH; c++) p[c] = z[c] + t->coef * p[c];
+    }
+}
+
+// q = A p; sums p.q
+static void ig_apply_job(void *arg, int worker, int n_workers) {
+    double pq = 0.0;
+    int r0, r1;
+    (void)arg;
+    pool_band(HEIGHT, worker, n_workers, &r0, &r1);
+    for (int r = r0; r < r1; r++) {
+        const float *p = GRID_ROW(ig.p, r);
+        float *q = GRID_ROW(ig.q, r);
+        ig_row_ax0(&ig.p, r, q);
+        pq += ig_dot(p, q, WIDTH);
+    }
+    ig.partial[worker * IG_SLOT] = pq;
+}
+
+// next_h += alpha p, r -= alpha q; sums |r|^2
+static void ig_update_job(void *arg, int worker, int n_workers) {
+    const ig_task *t = (const ig_task *)arg;
+    double rr = 0.0;
+    int r0, r1;
+    pool_band(HEIGHT, worker, n_workers, &r0, &r1);
+    for (int r = r0; r < r1; r++) {
+        const float *p = GRID_ROW(ig.p, r), *q = GRID_ROW(ig.q, r);
+        float *x = GRID_ROW(next_h, r), *res = GRID_ROW(ig.r, r);
+        for (int c = 0; c < WIDTH; c++) {
+            x[c] += t->coef * p[c];
+            res[c] -= t->coef * q[c];
+        }
+        rr += ig_dot(res, res, WIDTH);
+    }
+    ig.partial[worker * IG_SLOT] = rr;
+}
+
+// One level-0 Jacobi sweep over the water cells of row r (walls stay 0 in dst)
+static void ig_smooth_row0(const ig_task *t, int r) {
+    const float a = ig.a, inv_interior = IG_OMEGA * ig.inv_d0[4];
+    const ptrdiff_t stride = (ptrdiff_t)t->src->stride;
+    const float *b = GRID_ROW(ig.lv[0].b, r), *src = GRID_ROW(*t->src, r);
+    float *dst = GRID_ROW(*t->dst, r);
+    for (int s = plan.span_start[r]; s < plan.span_start[r + 1]; s++) {
+        const int c0 = plan.spans[s].c0, c1 = plan.spans[s].c1;
+        if (t->zero) {
+            for (int c = c0; c < c1; c++) dst[c] = inv_interior * b[c];
+        } else {
+            ig_span(src - stride, src, src + stride, b, dst, c0, c1, a, inv_interior);
+        }
+    }
+    for (int e = plan.edge_start[r]; e < plan.edge_start[r + 1]; e++) {
+        const unsigned char m = plan.edges[e].mask;
+        const int c = plan.edges[e].c;
+        const float inv_d = IG_OMEGA * ig.inv_d0[__builtin_popcount(m)];
+        if (t->zero) {
+            dst[c] = inv_d * b[c];
+        } else {
+            const float *center = src + c;
+            float lap = center[neighbor_offset(m, NB_UP, -stride)] + center[neighbor_offset(m, NB_DOWN, stride)]
+                      + center[neighbor_offset(m, NB_LEFT, -1)] + center[neighbor_offset(m, NB_RIGHT, 1)] - 4.0f * *center;
+            dst[c] = *center + inv_d * (b[c] - (*center - a * lap));
+        }
+    }
+}
+
+// One damped Jacobi sweep on a level: dst = src + omega (b - A src) / diag; sums b.dst
+static void ig_smooth_job(void *arg, int worker, int n_workers) {
+    const ig_task *t = (const ig_task *)arg;
+    const ig_level *lv = &ig.lv[t->level];
+    double bx = 0.0;
+    int r0, r1;
+    pool_band(lv->h, worker, n_workers, &r0, &r1);
+    for (int r = r0; r < r1; r++) {
+        const float *b = GRID_ROW(lv->b, r);
+        float *dst = GRID_ROW(*t->dst, r);
+        if (t->level == 0) {
+            ig_smooth_row0(t, r);
+        } else if (t->zero) {
+            const float *inv_d = GRID_ROW(lv->inv_d, r);
+            for (int c = 0; c < lv->w; c++) dst[c] = IG_OMEGA * inv_d[c] * b[c];
+        } else {
+            ig_coarse_row(lv, t->src, r, b, dst);
+        }
+        bx += ig_dot(b, dst, lv->w);
+    }
+    ig.partial[worker * IG_SLOT] = bx;
+}
+
+// Residual of a level summed over 2x2 blocks into the next level's right-hand side
+static void ig_restrict_job(void *arg, int worker, int n_workers) {
+    const ig_task *t = (const ig_task *)arg;
+    const ig_level *f = &ig.lv[t->level], *lv = f + 1;
+    float *ax = ig_scratch(worker);
+    int r0, r1;
+    pool_band(lv->h, worker, n_workers, &r0, &r1);
+    for (int R = r0; R < r1; R++) {
+        float *bc = GRID_ROW(lv->b, R);
+        memset(bc, 0, (size_t)lv->w * sizeof(float));
+        for (int r = 2 * R; r < 2 * R + 2 && r < f->h; r++) {
+            const float *b = GRID_ROW(f->b, r);
+            ig_row_ax(t->level, &f->x, r, ax);
+            for (int c = 0; c < f->w; c++) bc[c >> 1] += b[c] - ax[c];
+        }
+    }
+}
+
+// Add the next level's solution back onto the water cells of a level
+static void ig_prolong_job(void *arg, int worker, int n_workers) {
+    const ig_task *t = (const ig_task *)arg;
+    const ig_level *lv = &ig.lv[t->level], *coarse = lv + 1;
+    int r0, r1;
+    pool_band(lv->h, worker, n_workers, &r0, &r1);
+    for (int r = r0; r < r1; r++) {
+        const float *xc = GRID_ROW(coarse->x, r >> 1);
+        float *x = GRID_ROW(lv->x, r);
+        if (t->level == 0) {
+            for (int s = plan.span_start[r]; s < plan.span_start[r + 1]; s++) {
+                for (int c = plan.spans[s].c0; c < plan.spans[s].c1; c++) x[c] += xc[c >> 1];
+            }
+            for (int e = plan.edge_start[r]; e < plan.edge_start[r + 1]; e++) x[plan.edges[e].c] += xc[plan.edges[e].c >> 1];
+        } else {
+            const float *m = GRID_ROW(lv->m, r);
+            for (int c = 0; c < lv->w; c++) x[c] += m[c] > 0.0f ? xc[c >> 1] : 0.0f;
+        }
+    }
+}
+
+// `sweeps` Jacobi sweeps on a level, alternating x -> t -> x (an even count ends in x)
+static void ig_smooth(int level, int sweeps, int from_zero) {
+    ig_level *lv = &ig.lv[level];
+    ig_task task = { level, NULL, NULL, 0, 0.0f, 0.0f };
+    for (int i = 0; i < sweeps; i++) {
+        task.src = (i & 1) ? &lv->t : &lv->x;
+        task.dst = (i & 1) ? &lv->x : &lv->t;
+        task.zero = from_zero && i == 0;
+        ig_run(ig_smooth_job, &task, level);
+    }
+}
+
+// x = V-cycle applied to b on `level` and below. The smoother is symmetric, the
+// restriction is the transpose of the prolongation and every level's operator is
+// symmetric, so the cycle is a valid (fixed, symmetric) CG preconditioner. The last sweep on level 0 leaves r.z in the slots.
+static void ig_vcycle(int level) {
+    ig_task task = { level, NULL, NULL, 0, 0.0f, 0.0f };
+    if (level + 1 == ig.n_levels) {
+        ig_smooth(level, ig.coarse_sweeps, 1);
+        return;
+    }
+    ig_smooth(level, IG_SMOOTH, 1);
+    ig_run(ig_restrict_job, &task, level);
+    ig_vcycle(level + 1);
+    ig_run(ig_prolong_job, &task, level);
+    ig_smooth(level, IG_SMOOTH, 0);
+}
+
+// vel' = 2 (h' - h) / dt - vel, h' clamped; reports max |vel'| to the step monitor.
+// Walls have h = vel = h' = 0 and stay 0.
+static void ig_finish_job(void *arg, int worker, int n_workers) {
+    const ig_task *t = (const ig_task *)arg;
+    float max_vel = 0.0f;
+    int r0, r1;
+    pool_band(HEIGHT, worker, n_workers, &r0, &r1);
+    for (int r = r0; r < r1; r++) {
+        const float *h_row = GRID_ROW(h, r), *vel_row = GRID_ROW(vel, r);
+        float *x = GRID_ROW(next_h, r), *v = GRID_ROW(next_vel, r);
+        for (int c = 0; c < WIDTH; c++) {
+            float v_abs, h_new = x[c];
+            v[c] = t->coef * (h_new - h_row[c]) - vel_row[c];
+            v_abs = fabsf(v[c]);
+            max_vel = v_abs > max_vel ? v_abs : max_vel;
+            h_new = h_new > 0.0f ? h_new : 0.0f; // Compares instead of fmaxf/fminf: same result, but inlined
+            x[c] = h_new < 1.0f ? h_new : 1.0f;
+        }
+    }
+    monitor_slots[worker * MONITOR_SLOT] = max_vel;
+}
+
+static void implicit_step(void) {
+    const float dt = G_DT;
+    const float k = 1.0f + 0.5f * G_DAMPING * dt;
+    ig_task task = { 0, NULL, NULL, 0, dt, dt / k };
+    ig_prepare(G_WAVE_SPEED_SQ * dt * dt / (4.0f * k));
+
+    ig_run(ig_rhs_job, &task, 0);
+    const double limit = (double)G_CG_TOL * G_CG_TOL * ig_sum();
+    ig_run(ig_residual_job, &task, 0);
+    double rr = ig_sum(), rz = 0.0;
+    int it = 0;
+    while (rr > limit && it < IG_MAX_ITER) {
+        ig_vcycle(0);
+        double rz_next = ig_sum();
+        task.coef = it > 0 ? (float)(rz_next / rz) : 0.0f;
+        rz = rz_next;
+        ig_run(ig_direction_job, &task, 0);
+        ig_run(ig_apply_job, &task, 0);
+        double pq = ig_sum();
+        if (!(pq > 0.0)) break;
+        task.coef = (float)(rz / pq);
+        ig_run(ig_update_job, &task, 0);
+        rr = ig_sum();
+        it++;
+    }
+    ig.solves++;
+    ig.iterations += it;
+    if (it > ig.max_iterations) ig.max_iterations = it;
+    if (rr > limit) ig.capped++;
+
+    monitor_reserve(pool_size());
+    task.coef = 2.0f / dt;
+    ig_run(ig_finish_job, &task, 0);
+    monitor_collect(ig.parts, 1);
+    grid_f_swap(&h, &next_h);
+    grid_f_swap(&vel, &next_vel);
+}
+
+// --- Spectral Propagator ---
+// With --integrator spectral a step is exact in time for the continuous wave equation
+//   h_tt = speed_sq (h_xx + h_yy) - damping h_t
+// on the tank's water rectangle. The walls reflect (h_x = 0 at the border), so the
+// field is a sum of cosine modes cos(pi kx (c + 1/2) / nx) cos(pi ky (r + 1/2) / ny),
+// and each mode is an independent damped oscillator with w^2 = speed_sq |k|^2,
+// |k|^2 = (pi kx / nx)^2 + (pi ky / ny)^2. A step transforms h and vel (DCT-II, from
+// a complex FFT of the mirrored, hence periodic, rows and columns), advances every
+// mode over dt with the closed-form solution and transforms back, then clamps h to
+// [0, 1] as the other paths do. Any dt is stable and costs the same O(n log n), so
+// long simulated durations can be covered in a few large steps; the continuous |k|^2
+// also removes the 5-point laplacian's dispersion of short waves (so the 5-point
+// energy of compute_energy() is no longer exactly conserved: short waves carry more).
+//
+// It needs what the transform assumes: walls exactly on the border ring, none inside,
+// and a water region whose sides are powers of two (grid (2^i + 2) x (2^j + 2)).
+// h and vel are transformed in pairs as the real and imaginary part of one complex
+// sequence. Coefficients are kept in double, the per-mode propagator in float.
+#define SP_PI 3.14159265358979323846
+#define SP_BLOCK 8              // Columns transformed together (one cache line of coefficients)
+
+typedef struct {
+    int n;                    // Transform length (a power of two, >= 2)
+    double *tw_re, *tw_im;    // FFT twiddles by stage: [half + j] = e^(-i pi j / half), j < half
+    double *dct_re, *dct_im;  // DCT twiddles e^(-i pi k / 2n), k < n
+    int *rev;                 // Bit-reversed index
+    int *slot;                // Where sample j goes in the FFT input: evens ascending, odds descending
+} sp_axis;
+
+static struct {
+    int width, height;        // Grid the transforms were built for
+    float dt, speed_sq, damping; // Physics the propagator was built for
+    int valid;                // 0 until built; cleared by build_step_plan()
+    sp_axis x, y;             // Along rows (water width) and columns (water height)
+    double *hh, *vh;          // Cosine coefficients of h and vel, ny rows of nx
+    float *prop;              // Per mode: h' = p0 h + p1 vel, vel' = p2 h + p3 vel (inverse scale folded in)
+    double *scratch;          // Per worker: FFT real/imag parts of SP_BLOCK lines, two coefficient lines
+    int n_workers;            // Workers the scratch is sized for
+    size_t worker_doubles;    // Scratch doubles per worker
+} sp;
+
+void spectral_invalidate(void) { sp.valid = 0; }
+
+static void sp_axis_free(sp_axis *ax) {
+    free(ax->tw_re); free(ax->tw_im); free(ax->dct_re); free(ax->dct_im);
+    free(ax->rev); free(ax->slot);
+    memset(ax, 0, sizeof(*ax));
+}
+
+void free_spectral(void) {
+    sp_axis_free(&sp.x);
+    sp_axis_free(&sp.y);
+    aligned_block_free(sp.hh);
+    aligned_block_free(sp.vh);
+    aligned_block_free(sp.prop);
+    aligned_block_free(sp.scratch);
+    memset(&sp, 0, sizeof(sp));
+}
+
+static int sp_axis_init(sp_axis *ax, int n) {
+    ax->n = n;
+    ax->tw_re = (double *)malloc((size_t)n * sizeof(double));
+    ax->tw_im = (double *)malloc((size_t)n * sizeof(double));
+    ax->dct_re = (double *)malloc((size_t)n * sizeof(double));
+    ax->dct_im = (double *)malloc((size_t)n * sizeof(double));
+    ax->rev = (int *)malloc((size_t)n * sizeof(int));
+    ax->slot = (int *)malloc((size_t)n * sizeof(int));
+    if (!ax->tw_re || !ax->tw_im || !ax->dct_re || !ax->dct_im || !ax->rev || !ax->slot) return 0;
+    int bits = __builtin_ctz((unsigned)n);
+    for (int j = 0; j < n; j++) {
+        int r = 0;
+        for (int b = 0; b < bits; b++) r |= ((j >> b) & 1) << (bits - 1 - b);
+        ax->rev[j] = r;
+        ax->slot[j] = (j & 1) ? n - 1 - (j >> 1) : j >> 1;
+        ax->dct_re[j] = cos(SP_PI * j / (2.0 * n));
+        ax->dct_im[j] = -sin(SP_PI * j / (2.0 * n));
+    }
+    for (int half = 1; half < n; half <<= 1) {
+        for (int j = 0; j < half; j++) {
+            ax->tw_re[half + j] = cos(SP_PI * j / half);
+            ax->tw_im[half + j] = -sin(SP_PI * j / half);
+        }
+    }
+    return 1;
+}
+
+// In-place radix-2 FFT of re + i im (unnormalized; `inverse` flips the twiddles' sign)
+static void sp_fft(const sp_axis *ax, double *re, double *im, int inverse) {
+    const int n = ax->n;
+    const double sign = inverse ? -1.0 : 1.0;
+    for (int i = 0; i < n; i++) {
+        int j = ax->rev[i];
+        if (j > i) {
+            double t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+    for (int i = 0; i < n; i += 2) { // First stage: the twiddle is 1
+        const double xr = re[i + 1], xi = im[i + 1];
+        re[i + 1] = re[i] - xr; im[i + 1] = im[i] - xi;
+        re[i] += xr; im[i] += xi;
+    }
+    for (int half = 2; half < n; half <<= 1) {
+        const double *tw_re = ax->tw_re + half, *tw_im = ax->tw_im + half;
+        for (int i = 0; i < n; i += 2 * half) {
+            for (int j = 0; j < half; j++) {
+                const double wr = tw_re[j], wi = sign * tw_im[j];
+                const int p = i + j, q = p + half;
+                const double xr = re[q] * wr - im[q] * wi;
+                const double xi = re[q] * wi + im[q] * wr;
+                re[q] = re[p] - xr; im[q] = im[p] - xi;
+                re[p] += xr; im[p] += xi;
+            }
+        }
+    }
+}
+
+// Cosine transforms X[k] = sum_j x[j] cos(pi k (2j + 1) / 2n) of two real sequences a
+// and b, loaded into re and im at ax->slot[j]. The FFT of that ordering, turned by
+// e^(-i pi k / 2n), has X[k] as its real part; a's and b's halves of the joint FFT are
+// separated through Z[n - k] = conj(A[k]) - i conj(B[k]).
+static void sp_dct_pair(const sp_axis *ax, double *re, double *im, double *xa, double *xb) {
+    const int n = ax->n;
+    sp_fft(ax, re, im, 0);
+    for (int k = 0; k < n; k++) {
+        const int kc = (n - k) & (n - 1);
+        const double cr = re[kc], ci = -im[kc]; // conj(Z[n - k])
+        const double ar = 0.5 * (re[k] + cr), ai = 0.5 * (im[k] + ci);
+        const double br = 0.5 * (im[k] - ci), bi = -0.5 * (re[k] - cr);
+        xa[k] = ax->dct_re[k] * ar - ax->dct_im[k] * ai;
+        xb[k] = ax->dct_re[k] * br - ax->dct_im[k] * bi;
+    }
+}
+
+// The inverse, up to a factor n: re and im receive (at ax->slot[j])
+//   y[j] = X[0] + 2 sum_{k > 0} X[k] cos(pi k (2j + 1) / 2n)
+// for a's and b's coefficients. Both outputs are real, so they share one inverse FFT.
+static void sp_idct_pair(const sp_axis *ax, const double *xa, const double *xb, double *re, double *im) {
+    const int n = ax->n;
+    for (int k = 0; k < n; k++) {
+        const double wr = ax->dct_re[k], wi = -ax->dct_im[k];
+        const double ar = xa[k], ai = k ? -xa[n - k] : 0.0; // X[k] - i X[n - k]
+        const double br = xb[k], bi = k ? -xb[n - k] : 0.0;
+        const double va_r = ar * wr - ai * wi, va_i = ar * wi + ai * wr;
+        const double vb_r = br * wr - bi * wi, vb_i = br * wi + bi * wr;
+        re[k] = va_r - vb_i;
+        im[k] = va_i + vb_r;
+    }
+    sp_fft(ax, re, im, 1);
+}
+
+// Why the current grid cannot run spectrally, or NULL. Before the grids exist only the
+// size is checked.
+const char *spectral_unsupported(void) {
+    const int nx = WIDTH - 2, ny = HEIGHT - 2;
+    if (nx < 2 || ny < 2 || (nx & (nx - 1)) || (ny & (ny - 1))) {
+        return "needs a water region with power-of-two sides: a grid of (2^i + 2) x (2^j + 2), e.g. 130x66";
+    }
+    if (!obstacle.words) return NULL;
+    for (int r = 0; r < HEIGHT; r++) {
+        for (int c = 0; c < WIDTH; c++) {
+            int border = r == 0 || c == 0 || r == HEIGHT - 1 || c == WIDTH - 1;
+            if (BITS_AT(obstacle, r, c) != border) return "needs walls on the border ring only (no interior obstacles)";
+        }
+    }
+    return NULL;
+}
+
+static void sp_build(void) {
+    const char *why = spectral_unsupported();
+    if (why) {
+        fprintf(stderr, "Error: --integrator spectral %s.\n", why);
+        exit(EXIT_FAILURE);
+    }
+    free_spectral();
+    const int nx = WIDTH - 2, ny = HEIGHT - 2;
+    const size_t modes = (size_t)nx * (size_t)ny;
+    sp.hh = (double *)aligned_block_alloc(modes * sizeof(double));
+    sp.vh = (double *)aligned_block_alloc(modes * sizeof(double));
+    sp.prop = (float *)aligned_block_alloc(4 * modes * sizeof(float));
+    if (!sp_axis_init(&sp.x, nx) || !sp_axis_init(&sp.y, ny) || !sp.hh || !sp.vh || !sp.prop) {
+        fprintf(stderr, "Error: Memory allocation failed for the spectral propagator.\n");
+        exit(EXIT_FAILURE);
+    }
+    sp.width = WIDTH;
+    sp.height = HEIGHT;
+    sp.dt = -1.0f; // Propagator not filled in yet
+    sp.valid = 1;
+}
+
+// Propagator of every mode over dt, stored column-major (kx, then ky) in the order the
+// column pass visits modes. With g = damping / 2 and lambda = speed_sq |k|^2, a mode's
+// state moves by
+//   e^(-g dt) [ C + g S    S     ]
+//             [ -lambda S  C - g S ],   C = cos(w dt), S = sin(w dt) / w,  w^2 = lambda - g^2
+// (cosh/sinh when w^2 < 0, computed as decaying exponentials so no term overflows).
+// 1 / (nx ny), the inverse transforms' scale, is folded in.
+static void sp_build_propagator(float dt_f, float speed_sq, float damping) {
+    const int nx = sp.x.n, ny = sp.y.n;
+    const double dt = dt_f, g = 0.5 * (double)damping, scale = 1.0 / ((double)nx * ny);
+    for (int kx = 0; kx < nx; kx++) {
+        for (int ky = 0; ky < ny; ky++) {
+            const double wx = SP_PI * kx / nx, wy = SP_PI * ky / ny;
+            const double lambda = (double)speed_sq * (wx * wx + wy * wy);
+            const double w2 = lambda - g * g;
+            double ec, es; // e^(-g dt) C and e^(-g dt) S
+            if (w2 > 0.0) {
+                const double w = sqrt(w2), e = exp(-g * dt);
+                ec = e * cos(w * dt);
+                es = e * sin(w * dt) / w;
+            } else {
+                const double mu = sqrt(-w2);
+                if (mu * dt < 1e-4) { // Near critical: the series avoids cancellation
+                    const double e = exp(-g * dt);
+                    ec = e * (1.0 + 0.5 * mu * mu * dt * dt);
+                    es = e * dt * (1.0 + mu * mu * dt * dt / 6.0);
+                } else {
+                    const double slow = exp((mu - g) * dt), fast = exp(-(mu + g) * dt);
+                    ec = 0.5 * (slow + fast);
+                    es = 0.5 * (slow - fast) / mu;
+                }
+            }
+            float *p = sp.prop + 4 * ((size_t)kx * ny + ky);
+            p[0] = (float)(scale * (ec + g * es));
+            p[1] = (float)(scale * es);
+            p[2] = (float)(scale * -lambda * es);
+            p[3] = (float)(scale * (ec - g * es));
+        }
+    }
+    sp.dt = dt_f;
+    sp.speed_sq = speed_sq;
+    sp.damping = damping;
+}
+
+static void sp_prepare(void) {
+    if (!sp.valid || sp.width != WIDTH || sp.height != HEIGHT) sp_build();
+    if (sp.dt != G_DT || sp.speed_sq != G_WAVE_SPEED_SQ || sp.damping != G_DAMPING) {
+        sp_build_propagator(G_DT, G_WAVE_SPEED_SQ, G_DAMPING);
+    }
+    int n_workers = pool_size();
+    if (sp.n_workers < n_workers) {
+        const int n = sp.x.n > sp.y.n ? sp.x.n : sp.y.n;
+        aligned_block_free(sp.scratch);
+        sp.worker_doubles = (2 * SP_BLOCK + 2) * (size_t)n;
+        sp.scratch = (double *)aligned_block_alloc((size_t)n_workers * sp.worker_doubles * sizeof(double));
+        if (!sp.scratch) {
+            fprintf(stderr, "Error: Memory allocation failed for the spectral propagator.\n");
+            exit(EXIT_FAILURE);
+        }
+        sp.n_workers = n_workers;
+    }
+}
+
+static double *sp_scratch(int worker) { return sp.scratch + (size_t)worker * sp.worker_doubles; }
+
+// Rows: h and vel of each water row to cosine coefficients along x
+static void sp_rows_forward_job(void *arg, int worker, int n_workers) {
+    const int nx = sp.x.n;
+    double *re = sp_scratch(worker), *im = re + nx;
+    int i0, i1;
+    (void)arg;
+    pool_band(sp.y.n, worker, n_workers, &i0, &i1);
+    for (int i = i0; i < i1; i++) {
+        const float *h_row = GRID_ROW(h, i + 1) + 1, *vel_row = GRID_ROW(vel, i + 1) + 1;
+        for (int j = 0; j < nx; j++) {
+            re[sp.x.slot[j]] = h_row[j];
+            im[sp.x.slot[j]] = vel_row[j];
+        }
+        sp_dct_pair(&sp.x, re, im, sp.hh + (size_t)i * nx, sp.vh + (size_t)i * nx);
+    }
+}
+
+// Columns: transform along y, advance every mode of the column over dt, transform back.
+// SP_BLOCK neighbouring columns are gathered and scattered together, so each pass over
+// the coefficient rows uses whole cache lines.
+static void sp_columns_job(void *arg, int worker, int n_workers) {
+    const int nx = sp.x.n, ny = sp.y.n;
+    double *re = sp_scratch(worker), *im = re + SP_BLOCK * ny;
+    double *ca = im + SP_BLOCK * ny, *cb = ca + ny;
+    int b0, b1;
+    (void)arg;
+    pool_band((nx + SP_BLOCK - 1) / SP_BLOCK, worker, n_workers, &b0, &b1);
+    for (int k0 = b0 * SP_BLOCK; k0 < b1 * SP_BLOCK && k0 < nx; k0 += SP_BLOCK) {
+        const int n_cols = nx - k0 < SP_BLOCK ? nx - k0 : SP_BLOCK;
+        for (int i = 0; i < ny; i++) {
+            const double *hh = sp.hh + (size_t)i * nx + k0, *vh = sp.vh + (size_t)i * nx + k0;
+            for (int b = 0; b < n_cols; b++) {
+                re[b * ny + sp.y.slot[i]] = hh[b];
+                im[b * ny + sp.y.slot[i]] = vh[b];
+            }
+        }
+        for (int b = 0; b < n_cols; b++) {
+            sp_dct_pair(&sp.y, re + b * ny, im + b * ny, ca, cb);
+            const float *p = sp.prop + 4 * (size_t)(k0 + b) * ny;
+            for (int i = 0; i < ny; i++, p += 4) {
+                const double x = ca[i], v = cb[i];
+                ca[i] = p[0] * x + p[1] * v;
+                cb[i] = p[2] * x + p[3] * v;
+            }
+            sp_idct_pair(&sp.y, ca, cb, re + b * ny, im + b * ny);
+        }
+        for (int i = 0; i < ny; i++) {
+            double *hh = sp.hh + (size_t)i * nx + k0, *vh = sp.vh + (size_t)i * nx + k0;
+            for (int b = 0; b < n_cols; b++) {
+                hh[b] = re[b * ny + sp.y.slot[i]];
+                vh[b] = im[b * ny + sp.y.slot[i]];
+            }
+        }
+    }
+}
+
+// Rows: back to h' (clamped) and vel'; reports max |vel'| to the step monitor.
+// Walls stay 0 in next_h/next_vel (see build_step_plan).
+static void sp_rows_inverse_job(void *arg, int worker, int n_workers) {
+    const int nx = sp.x.n;
+    double *re = sp_scratch(worker), *im = re + nx;
+    float max_vel = 0.0f;
+    int i0, i1;
+    (void)arg;
+    pool_band(sp.y.n, worker, n_workers, &i0, &i1);
+    for (int i = i0; i < i1; i++) {
+        float *h_row = GRID_ROW(next_h, i + 1) + 1, *vel_row = GRID_ROW(next_vel, i + 1) + 1;
+        sp_idct_pair(&sp.x, sp.hh + (size_t)i * nx, sp.vh + (size_t)i * nx, re, im);
+        for (int j = 0; j < nx; j++) {
+            float h_new = (float)re[sp.x.slot[j]], v = (float)im[sp.x.slot[j]];
+            float v_abs = fabsf(v);
+            max_vel = v_abs > max_vel ? v_abs : max_vel;
+            h_new = h_new > 0.0f ? h_new : 0.0f;
+            h_row[j] = h_new < 1.0f ? h_new : 1.0f;
+            vel_row[j] = v;
+        }
+    }
+    monitor_slots[worker * MONITOR_SLOT] = max_vel;
+}
+
+static void spectral_step(void) {
+    sp_prepare();
+    monitor_reserve(pool_size());
+    pool_run(sp_rows_forward_job, NULL);
+    pool_run(sp_columns_job, NULL);
+    pool_run(sp_rows_inverse_job, NULL);
+    monitor_collect(pool_size(), 1);
+    grid_f_swap(&h, &next_h);
+    grid_f_swap(&vel, &next_vel);
+}
+
+// --- Process Slabs ---
+// With --procs N the grid is split into N bands of rows ("slabs"), each owned and
+// stepped by its own forked worker process. A worker pins itself to a NUMA node
+// (slabs are spread evenly over the nodes listed in /sys/devices/system/node) before
+// allocating its slab, so the slab's pages are placed on that node by first touch.
+// Each step the workers trade one-row halos of h with their neighbours through a
+// POSIX shared-memory segment: a worker publishes its first and last row, bumps its
+// step counter and waits (spinning briefly, then on a futex) for the neighbours'
+// counters to reach the same step. The halo slots are double-buffered by step parity,
+// so a row is never overwritten before the neighbour has read it.
+//
+// This process coordinates: each simulation_advance() is one command (a number of
+// steps), after which every worker copies its slab's h and vel into the segment. The
+// coordinator's h and vel point there while the workers run, so display_grid(),
+// checkpoints and reports read the assembled frame as usual.
+#define SLAB_SPINS 4096          // Polls before sleeping on the futex
+#define SLAB_WAIT_NS 100000000L  // Futex sleeps are cut to this, to notice a dead peer
+
+typedef struct {
+    atomic_int command;          // Bumped for each command (futex word)
+    atomic_int done;             // Workers that finished the current command (futex word)
+    int steps;                   // Steps of the current command (< 0: exit)
+} slab_control;
+
+typedef struct {
+    atomic_int published;        // Steps whose halo rows are in place (futex word)
+    float max_vel;               // Max |vel| of the worker's last step
+    int node;                    // NUMA node the worker is pinned to (-1 = not pinned)
+    char pad[64 - 3 * sizeof(int)];
+} slab_worker_state;
+
+static struct {
+    int n;                       // Worker processes (0 = not running)
+    pid_t *pids;
+    pid_t coordinator;
+    int worker;                  // This process's slab (-1 in the coordinator)
+    char *map;                   // The shared segment...
+    size_t map_bytes;
+    slab_control *ctrl;          // ...holding the control block,
+    slab_worker_state *ws;       // per-worker state,
+    float *halo;                 // halo rows [parity][worker][first, last],
+    float *frame_h, *frame_vel;  // and the assembled fields
+    int n_nodes;
+} slab;
+
+#ifndef _WIN32
+static float *slab_halo_row(int parity, int worker, int last) {
+    return slab.halo + ((size_t)(parity * slab.n + worker) * 2 + (size_t)last) * h.stride;
+}
+
+// Coordinator: a worker has exited. Worker: the coordinator has.
+static int slab_peer_lost(void) {
+    if (slab.worker >= 0) return getppid() != slab.coordinator;
+    for (int i = 0; i < slab.n; i++) {
+        if (waitpid(slab.pids[i], NULL, WNOHANG) != 0) return 1;
+    }
+    return 0;
+}
+
+static void slab_wake(atomic_int *word) {
+#ifdef __linux__
+    syscall(SYS_futex, (int *)word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#else
+    (void)word;
+#endif
+}
+
+// Wait until *word >= target; exits if the peer process is gone
+static void slab_wait(atomic_int *word, int target) {
+    for (int spins = 0;; spins++) {
+        int v = atomic_load_explicit(word, memory_order_acquire);
+        if (v >= target) return;
+        if (spins < SLAB_SPINS) continue;
+#ifdef __linux__
+        struct timespec timeout = { 0, SLAB_WAIT_NS };
+        syscall(SYS_futex, (int *)word, FUTEX_WAIT, v, &timeout, NULL, 0);
+#else
+        sched_yield();
+#endif
+        if (slab_peer_lost()) {
+            if (slab.worker >= 0) _exit(1);
+            fprintf(stderr, "Error: a slab worker process exited unexpectedly.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// Number of NUMA nodes, and the CPUs of `node` as a mask (Linux sysfs; 0 elsewhere)
+static int slab_numa_node_cpus(int node, unsigned long *mask, int mask_words) {
+    char path[64];
+    int n_nodes = 0;
+    for (;; n_nodes++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", n_nodes);
+        if (access(path, R_OK) != 0) break;
+    }
+    if (!mask || node >= n_nodes) return n_nodes;
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    int lo, hi;
+    memset(mask, 0, (size_t)mask_words * sizeof(unsigned long));
+    while (fscanf(f, "%d", &lo) == 1) { // "0-3,8-11"
+        hi = lo;
+        int sep = fgetc(f);
+        if (sep == '-') {
+            if (fscanf(f, "%d", &hi) != 1) break;
+            sep = fgetc(f);
+        }
+        for (int cpu = lo; cpu <= hi && cpu < mask_words * 64; cpu++) mask[cpu / 64] |= 1ul << (cpu % 64);
+        if (sep != ',') break;
+    }
+    fclose(f);
+    return n_nodes;
+}
+
+// Pin this worker to its share of the NUMA nodes; returns the node (-1 = not pinned)
+static int slab_pin(int worker) {
+#ifdef __linux__
+    unsigned long mask[16];
+    if (slab.n_nodes < 1) return -1;
+    int node = (int)((long long)worker * slab.n_nodes / slab.n);
+    if (slab_numa_node_cpus(node, mask, 16) <= node) return -1;
+    if (syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) != 0) return -1;
+    return node;
+#else
+    (void)worker;
+    return -1;
+#endif
+}
+
+// Worker process: own rows [r0, r1) of the grid and run commands until told to exit.
+// The slab grids hold the rows plus a halo row on each side (local row i = grid row r0 - 1 + i).
+static void slab_worker(int worker) {
+    signal(SIGINT, SIG_IGN);  // The coordinator stops the workers
+    signal(SIGTERM, SIG_IGN);
+    slab.ws[worker].node = slab_pin(worker);
+
+    int r0, r1;
+    pool_band(HEIGHT, worker, slab.n, &r0, &r1);
+    const int rows = r1 - r0 + 2;
+    grid_f sh, sv, snh, snv;
+    int ok = grid_f_alloc(&sh, WIDTH, rows);
+    ok = grid_f_alloc(&sv, WIDTH, rows) && ok;
+    ok = grid_f_alloc(&snh, WIDTH, rows) && ok;
+    ok = grid_f_alloc(&snv, WIDTH, rows) && ok;
+    if (!ok) {
+        fprintf(stderr, "Error: Memory allocation failed for slab %d.\n", worker);
+        _exit(1);
+    }
+    const size_t row_bytes = (size_t)WIDTH * sizeof(float);
+    for (int i = 0; i < rows; i++) {
+        int r = r0 - 1 + i;
+        if (r < 0 || r >= HEIGHT) continue; // Past the grid: never read
+        memcpy(GRID_ROW(sh, i), slab.frame_h + (size_t)r * h.stride, row_bytes);
+        memcpy(GRID_ROW(sv, i), slab.frame_vel + (size_t)r * h.stride, row_bytes);
+        memcpy(GRID_ROW(snh, i), GRID_ROW(sh, i), row_bytes); // Walls are 0 in both buffers
+        memcpy(GRID_ROW(snv, i), GRID_ROW(sv, i), row_bytes);
+    }
+    atomic_fetch_add_explicit(&slab.ctrl->done, 1, memory_order_release); // Ready
+    slab_wake(&slab.ctrl->done);
+
+    const ptrdiff_t stride = (ptrdiff_t)sh.stride;
+    slab_worker_state *self = &slab.ws[worker];
+    int command = 0, step = 0;
+    for (;;) {
+        slab_wait(&slab.ctrl->command, ++command);
+        const int steps = slab.ctrl->steps;
+        if (steps < 0) break;
+        const kernel_params kp = current_kernel_params();
+        float max_vel = 0.0f;
+        for (int s = 0; s < steps; s++) {
+            max_vel = 0.0f;
+            for (int r = r0; r < r1; r++) {
+                int i = r - r0 + 1;
+                float row_max = step_row_span(r, 0, WIDTH, 0, stride, GRID_ROW(sh, i), GRID_ROW(sv, i),
+                                              GRID_ROW(snh, i), GRID_ROW(snv, i), &kp);
+                max_vel = fmaxf(max_vel, row_max);
+            }
+            // Publish the new first and last row, then take the neighbours'
+            const int parity = ++step & 1;
+            memcpy(slab_halo_row(parity, worker, 0), GRID_ROW(snh, 1), row_bytes);
+            memcpy(slab_halo_row(parity, worker, 1), GRID_ROW(snh, rows - 2), row_bytes);
+            atomic_store_explicit(&self->published, step, memory_order_release);
+            slab_wake(&self->published);
+            if (worker > 0) {
+                slab_wait(&slab.ws[worker - 1].published, step);
+                memcpy(GRID_ROW(snh, 0), slab_halo_row(parity, worker - 1, 1), row_bytes);
+            }
+            if (worker + 1 < slab.n) {
+                slab_wait(&slab.ws[worker + 1].published, step);
+                memcpy(GRID_ROW(snh, rows - 1), slab_halo_row(parity, worker + 1, 0), row_bytes);
+            }
+            grid_f_swap(&sh, &snh);
+            grid_f_swap(&sv, &snv);
+        }
+        for (int r = r0; r < r1; r++) {
+            memcpy(slab.frame_h + (size_t)r * h.stride, GRID_ROW(sh, r - r0 + 1), row_bytes);
+            memcpy(slab.frame_vel + (size_t)r * h.stride, GRID_ROW(sv, r - r0 + 1), row_bytes);
+        }
+        self->max_vel = max_vel;
+        atomic_fetch_add_explicit(&slab.ctrl->done, 1, memory_order_release);
+        slab_wake(&slab.ctrl->done);
+    }
+    grid_f_free(&sh); grid_f_free(&sv); grid_f_free(&snh); grid_f_free(&snv);
+}
+
+// Send a command to every worker and wait until all have finished it
+static void slab_command(int steps) {
+    atomic_store_explicit(&slab.ctrl->done, 0, memory_order_relaxed);
+    slab.ctrl->steps = steps;
+    atomic_fetch_add_explicit(&slab.ctrl->command, 1, memory_order_release);
+    slab_wake(&slab.ctrl->command);
+    if (steps >= 0) slab_wait(&slab.ctrl->done, slab.n);
+}
+#endif
+
+// Move h and vel into a shared segment and fork one worker per slab. Returns the
+// number of workers (0 if the processes could not be started; the run then stays here).
+int slab_start(int n) {
+#ifndef _WIN32
+    const size_t field = h.stride * (size_t)HEIGHT * sizeof(float);
+    const size_t halo = 4 * (size_t)n * h.stride * sizeof(float);
+    const size_t head = (sizeof(slab_control) + 63) / 64 * 64 + (size_t)n * sizeof(slab_worker_state);
+    const size_t bytes = (head + 4095) / 4096 * 4096 + halo + 2 * field;
+    char name[64];
+    snprintf(name, sizeof(name), "/cfd-slabs-%ld", (long)getpid());
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) { fprintf(stderr, "Error: shm_open failed: %s\n", strerror(errno)); return 0; }
+    shm_unlink(name); // The mapping lives on in this process and its workers
+    void *map = ftruncate(fd, (off_t)bytes) == 0 ? mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED) { fprintf(stderr, "Error: could not map the slab segment: %s\n", strerror(errno)); return 0; }
+    slab.pids = (pid_t *)malloc((size_t)n * sizeof(pid_t));
+    if (!slab.pids) { munmap(map, bytes); return 0; }
+
+    slab.map = (char *)map;
+    slab.map_bytes = bytes;
+    slab.ctrl = (slab_control *)slab.map;
+    slab.ws = (slab_worker_state *)(slab.map + (sizeof(slab_control) + 63) / 64 * 64);
+    slab.halo = (float *)(slab.map + (head + 4095) / 4096 * 4096);
+    slab.frame_h = (float *)((char *)slab.halo + halo);
+    slab.frame_vel = (float *)((char *)slab.frame_h + field);
+    memcpy(slab.frame_h, h.data, field);
+    memcpy(slab.frame_vel, vel.data, field);
+    slab.n = n;
+    slab.n_nodes = slab_numa_node_cpus(0, NULL, 0);
+    slab.coordinator = getpid();
+    slab.worker = -1;
+
+    fflush(stdout); // Forked workers must not inherit buffered output
+    for (int i = 0; i < n; i++) {
+        slab.pids[i] = fork();
+        if (slab.pids[i] < 0) {
+            fprintf(stderr, "Error: could not start slab worker %d: %s\n", i, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        if (slab.pids[i] == 0) {
+            slab.worker = i;
+            slab_worker(i);
+            _exit(0);
+        }
+    }
+    slab_wait(&slab.ctrl->done, n); // Every slab copied in
+
+    // The coordinator's fields are now the assembled frame
+    aligned_block_free(h.data);
+    aligned_block_free(vel.data);
+    h.data = slab.frame_h;
+    vel.data = slab.frame_vel;
+    return n;
+#else
+    (void)n;
+    return 0;
+#endif
+}
+
+// Stop the workers and take h and vel back into this process
+void slab_stop(void) {
+#ifndef _WIN32
+    if (slab.n == 0) return;
+    slab_command(-1);
+    for (int i = 0; i < slab.n; i++) {
+        while (waitpid(slab.pids[i], NULL, 0) < 0 && errno == EINTR) {}
+    }
+    const size_t field = h.stride * (size_t)HEIGHT * sizeof(float);
+    h.data = (float *)aligned_block_alloc(field);
+    vel.data = (float *)aligned_block_alloc(field);
+    if (!h.data || !vel.data) {
+        fprintf(stderr, "Error: Memory allocation failed for grids.\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(h.data, slab.frame_h, field);
+    memcpy(vel.data, slab.frame_vel, field);
+    munmap(slab.map, slab.map_bytes);
+    free(slab.pids);
+    memset(&slab, 0, sizeof(slab));
+#endif
+}
+
+// Advance `steps` steps on the workers; reports max |vel| to the step monitor
+static void slab_advance(int steps) {
+#ifndef _WIN32
+    slab_command(steps);
+    monitor_reserve(slab.n);
+    for (int i = 0; i < slab.n; i++) monitor_slots[i * MONITOR_SLOT] = slab.ws[i].max_vel;
+    monitor_collect(slab.n, steps);
+#else
+    (void)steps;
+#endif
+}
+
+void simulation_step() {
+    if (slab.n > 0) {
+        slab_advance(1);
+        return;
+    }
+    if (G_INTEGRATOR == INTEGRATOR_IMPLICIT) {
+        implicit_step();
+        return;
+    }
+    if (G_INTEGRATOR == INTEGRATOR_SPECTRAL) {
+        spectral_step();
+        return;
+    }
+    if (G_STORAGE != STORAGE_FP32) {
+        storage_step();
+        return;
+    }
+    if (G_ACTIVE_TILES) {
+        active_tiles_prepare();
+        active_tiles_step();
+        grid_f_swap(&h, &next_h);
+        grid_f_swap(&vel, &next_vel);
+        return;
+    }
+    // Update every water cell:
+    //   laplacian = h_up + h_down + h_left + h_right - 4*h   (walls reflect: they read as h)
+    //   vel' = (vel + speed_sq * laplacian * dt) * (1 - damping * dt)
+    //   h'   = clamp(h + vel' * dt, 0, 1)
+    // Obstacles keep h = vel = 0 in both buffers (see build_step_plan).
+    monitor_reserve(pool_size());
+    pool_run(step_job, NULL);
+    monitor_collect(pool_size(), 1);
+
+    // Swap current and next state buffers (only the grid headers move, not the data)
+    grid_f_swap(&h, &next_h);
+    grid_f_swap(&vel, &next_vel);
+}
+
+// --- Temporal Blocking ---
+// With --time-block K the grid is cut into overlapping tiles sized for L2. Each tile is
+// copied with a K-cell halo into per-worker scratch and advanced K steps there (the
+// computed region shrinks by one cell per step), then only its own cells are written
+// to next_h/next_vel. One pass over DRAM thus covers K steps. Every cell sees the
+// exact same sequence of operations as with K single steps.
+#define TB_TILE_SPAN 256   // Scratch side incl. halos; 4 fields * 256^2 floats = 1 MiB
+
+typedef struct {
+    float *h[2];           // Ping-pong height scratch, TB_TILE_SPAN^2 floats each
+    float *vel[2];         // Ping-pong velocity scratch
+} tb_scratch;
+
+static tb_scratch *tb_scratches = NULL;  // One per pool worker
+static int tb_n_scratches = 0;
+
+void time_block_free(void) {
+    for (int i = 0; i < tb_n_scratches; i++) {
+        for (int b = 0; b < 2; b++) {
+            aligned_block_free(tb_scratches[i].h[b]);
+            aligned_block_free(tb_scratches[i].vel[b]);
+        }
+    }
+    free(tb_scratches);
+    tb_scratches = NULL;
+    tb_n_scratches = 0;
+}
+
+static void time_block_reserve(int n_workers) {
+    if (tb_n_scratches >= n_workers) return;
+    time_block_free();
+    tb_scratches = (tb_scratch *)calloc((size_t)n_workers, sizeof(tb_scratch));
+    if (!tb_scratches) goto fail;
+    tb_n_scratches = n_workers;
+    for (int i = 0; i < n_workers; i++) {
+        for (int b = 0; b < 2; b++) {
+            size_t bytes = (size_t)TB_TILE_SPAN * TB_TILE_SPAN * sizeof(float);
+            tb_scratches[i].h[b] = (float *)aligned_block_alloc(bytes);
+            tb_scratches[i].vel[b] = (float *)aligned_block_alloc(bytes);
+            if (!tb_scratches[i].h[b] || !tb_scratches[i].vel[b]) goto fail;
+        }
+    }
+    return;
+fail:
+    fprintf(stderr, "Error: Memory allocation failed for time-block scratch.\n");
+    exit(EXIT_FAILURE);
+}
+
+typedef struct {
+    int k;                 // Steps per tile visit
+    int tile;              // Output tile side (TB_TILE_SPAN - 2k)
+    int tiles_x, tiles_y;
+} tb_job_args;
+
+// Advance output tile [R0, R1) x [C0, C1) by k steps into next_h/next_vel
+static float tb_advance_tile(tb_scratch *sc, int R0, int R1, int C0, int C1, int k,
+                            const kernel_params *kp) {
+    const ptrdiff_t ss = TB_TILE_SPAN;
+    // Loaded region: the tile plus a k-cell halo, clipped to the grid
+    int lr0 = R0 - k > 0 ? R0 - k : 0, lr1 = R1 + k < HEIGHT ? R1 + k : HEIGHT;
+    int lc0 = C0 - k > 0 ? C0 - k : 0, lc1 = C1 + k < WIDTH ? C1 + k : WIDTH;
+    size_t row_bytes = (size_t)(lc1 - lc0) * sizeof(float);
+
+    // Both ping-pong buffers start from the current state, so walls (never written
+    // by the step) read as zero whichever buffer ends up holding the result
+    for (int r = lr0; r < lr1; r++) {
+        for (int b = 0; b < 2; b++) {
+            memcpy(sc->h[b] + (r - lr0) * ss, GRID_ROW(h, r) + lc0, row_bytes);
+            memcpy(sc->vel[b] + (r - lr0) * ss, GRID_ROW(vel, r) + lc0, row_bytes);
+        }
+    }
+
+    float max_vel = 0.0f;
+    for (int step = 1; step <= k; step++) {
+        int grow = k - step; // Halo cells still needed by the remaining steps
+        int cr0 = R0 - grow > 0 ? R0 - grow : 0, cr1 = R1 + grow < HEIGHT ? R1 + grow : HEIGHT;
+        int cc0 = C0 - grow > 0 ? C0 - grow : 0, cc1 = C1 + grow < WIDTH ? C1 + grow : WIDTH;
+        int src = (step - 1) & 1, dst = step & 1;
+        for (int r = cr0; r < cr1; r++) {
+            ptrdiff_t off = (r - lr0) * ss;
+            float row_max = step_row_span(r, cc0, cc1, lc0, ss,
+                                          sc->h[src] + off, sc->vel[src] + off,
+                                          sc->h[dst] + off, sc->vel[dst] + off, kp);
+            if (step == k) max_vel = fmaxf(max_vel, row_max); // Only the tile's own final cells
+        }
+    }
+
+    size_t out_bytes = (size_t)(C1 - C0) * sizeof(float);
+    for (int r = R0; r < R1; r++) {
+        ptrdiff_t off = (r - lr0) * ss + (C0 - lc0);
+        memcpy(GRID_ROW(next_h, r) + C0, sc->h[k & 1] + off, out_bytes);
+        memcpy(GRID_ROW(next_vel, r) + C0, sc->vel[k & 1] + off, out_bytes);
+    }
+    return max_vel;
+}
+
+// Pool job: tiles are dealt out round-robin
+static void tb_job(void *arg, int worker, int n_workers) {
+    const tb_job_args *a = (const tb_job_args *)arg;
+    const kernel_params kp = current_kernel_params();
+    float max_vel = 0.0f;
+    for (int t = worker; t < a->tiles_x * a->tiles_y; t += n_workers) {
+        int R0 = (t / a->tiles_x) * a->tile, C0 = (t % a->tiles_x) * a->tile;
+        int R1 = R0 + a->tile < HEIGHT ? R0 + a->tile : HEIGHT;
+        int C1 = C0 + a->tile < WIDTH ? C0 + a->tile : WIDTH;
+        max_vel = fmaxf(max_vel, tb_advance_tile(&tb_scratches[worker], R0, R1, C0, C1, a->k, &kp));
+    }
+    monitor_slots[worker * MONITOR_SLOT] = max_vel;
+}
+
+// Advance k (<= G_TIME_BLOCK) steps with one pass over the grid
+static void time_block_step(int k) {
+    tb_job_args a;
+    a.k = k;
+    a.tile = TB_TILE_SPAN - 2 * k;
+    a.tiles_x = (WIDTH + a.tile - 1) / a.tile;
+    a.tiles_y = (HEIGHT + a.tile - 1) / a.tile;
+    time_block_reserve(pool_size());
+    monitor_reserve(pool_size());
+    pool_run(tb_job, &a);
+    monitor_collect(pool_size(), k);
+    grid_f_swap(&h, &next_h);
+    grid_f_swap(&vel, &next_vel);
+}
+
+// Largest accepted --time-block: leaves an output tile of at least 64 cells per side
+#define TB_MAX_K ((TB_TILE_SPAN - 64) / 2)
+
+// --- Performance Counters ---
+// --perf-counters opens one perf_event group per pool worker (each worker opens its
+// own, so the group counts that thread only): cycles, instructions, LLC misses,
+// branch misses and dTLB load misses, user space only. The groups are enabled just
+// around each step or time block, so the barrier spinning between steps is not
+// counted, and read once at exit. Events the host lacks are reported as n/a; if
+// none can be opened the run continues without counters.
+enum { PERF_CYCLES, PERF_INSTRUCTIONS, PERF_LLC_MISSES, PERF_BRANCH_MISSES, PERF_DTLB_MISSES, N_PERF };
+static const char *const PERF_NAMES[N_PERF] = { "cycles", "instructions", "LLC misses", "branch misses", "dTLB misses" };
+
+int G_PERF_COUNTERS = 0; // Sample hardware counters around each step (--perf-counters)
+
+static struct {
+    int armed;           // Counting requested for the main run (perf_arm)
+    int opened;          // Groups opened (on the first step after arming)
+    int n_workers;
+    int *fd;             // fd[worker * N_PERF + event], -1 if unavailable
+    int *leader;         // Group leader fd per worker (-1 if the worker has none)
+    int open_errno;      // Why the first event could not be opened
+    long long steps;     // Steps counted
+} perf;
+
+#ifdef __linux__
+static int perf_open_event(int event, int group_fd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    switch (event) {
+    case PERF_CYCLES:        attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+    case PERF_INSTRUCTIONS:  attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+    case PERF_LLC_MISSES:    attr.config = PERF_COUNT_HW_CACHE_MISSES; break;
+    case PERF_BRANCH_MISSES: attr.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+    default:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    }
+    attr.disabled = group_fd < 0; // Members follow the leader
+    attr.exclude_kernel = 1;      // Allowed at perf_event_paranoid 2
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+// Pool job: open this worker's group on its own thread
+static void perf_open_job(void *arg, int worker, int n_workers) {
+    (void)arg; (void)n_workers;
+    int *fd = perf.fd + (size_t)worker * N_PERF;
+    perf.leader[worker] = -1;
+    for (int e = 0; e < N_PERF; e++) {
+        fd[e] = perf_open_event(e, perf.leader[worker]);
+        if (fd[e] < 0 && worker == 0 && !perf.open_errno) perf.open_errno = errno;
+        if (fd[e] >= 0 && perf.leader[worker] < 0) perf.leader[worker] = fd[e];
+    }
+}
+
+static void perf_open(void) {
+    perf.opened = 1;
+    perf.n_workers = pool_size();
+    perf.fd = (int *)malloc((size_t)perf.n_workers * N_PERF * sizeof(int));
+    perf.leader = (int *)malloc((size_t)perf.n_workers * sizeof(int));
+    if (!perf.fd || !perf.leader) { perf.armed = 0; return; }
+    pool_run(perf_open_job, NULL);
+    int any = 0;
+    for (int w = 0; w < perf.n_workers; w++) any |= perf.leader[w] >= 0;
+    if (!any) {
+        FILE *f = fopen("/proc/sys/kernel/perf_event_paranoid", "r");
+        int paranoid = -99;
+        if (f) { if (fscanf(f, "%d", &paranoid) != 1) paranoid = -99; fclose(f); }
+        fprintf(stderr, "Warning: --perf-counters: no hardware counters available (%s", strerror(perf.open_errno));
+        if (paranoid != -99) fprintf(stderr, ", perf_event_paranoid = %d", paranoid);
+        fprintf(stderr, "); continuing without them.\n");
+        perf.armed = 0;
+    }
+}
+
+static void perf_group_ioctl(unsigned long request) {
+    for (int w = 0; w < perf.n_workers; w++) {
+        if (perf.leader[w] >= 0) ioctl(perf.leader[w], request, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+// Bracket one step or time block of `steps` steps
+static void perf_begin(void) {
+    if (!perf.armed) return;
+    if (!perf.opened) perf_open();
+    if (perf.armed) perf_group_ioctl(PERF_EVENT_IOC_ENABLE);
+}
+
+static void perf_end(int steps) {
+    if (!perf.armed) return;
+    perf_group_ioctl(PERF_EVENT_IOC_DISABLE);
+    perf.steps += steps;
+}
+
+// Sum of each event over the workers, scaled up where the kernel multiplexed the
+// group; *scaled is set if any group was not on the PMU all the time
+static void perf_totals(double *total, int *have, int *scaled) {
+    uint64_t buf[3 + N_PERF];
+    *scaled = 0;
+    for (int e = 0; e < N_PERF; e++) { total[e] = 0.0; have[e] = 0; }
+    for (int w = 0; w < perf.n_workers; w++) {
+        if (perf.leader[w] < 0 || read(perf.leader[w], buf, sizeof(buf)) < (ssize_t)(3 * sizeof(uint64_t))) continue;
+        uint64_t nr = buf[0], enabled = buf[1], running = buf[2];
+        double scale = running > 0 ? (double)enabled / (double)running : 0.0;
+        if (running < enabled) *scaled = 1;
+        // Values come in the order the events joined the group
+        uint64_t i = 0;
+        for (int e = 0; e < N_PERF && i < nr; e++) {
+            if (perf.fd[(size_t)w * N_PERF + e] < 0) continue;
+            total[e] += (double)buf[3 + i++] * scale;
+            have[e] = 1;
+        }
+    }
+}
+#else // No perf_event_open
+static void perf_open(void) {
+    perf.opened = 1;
+    perf.armed = 0;
+    fprintf(stderr, "Warning: --perf-counters is only available on Linux; continuing without it.\n");
+}
+static void perf_begin(void) { if (perf.armed && !perf.opened) perf_open(); }
+static void perf_end(int steps) { (void)steps; }
+static void perf_totals(double *total, int *have, int *scaled) {
+    *scaled = 0;
+    for (int e = 0; e < N_PERF; e++) { total[e] = 0.0; have[e] = 0; }
+}
+#endif
+
+// Start counting with the next step (call once the run proper begins)
+void perf_arm(void) {
+    if (G_PERF_COUNTERS) perf.armed = 1;
+}
+
+// Print per-cell rates for the counted steps, then close the groups
+void perf_report(void) {
+    if (perf.armed && perf.steps > 0) {
+        double total[N_PERF];
+        int have[N_PERF], scaled;
+        perf_totals(total, have, &scaled);
+        double cells = (double)perf.steps * WIDTH * HEIGHT;
+        printf("Perf counters: %lld steps x %dx%d cells, %d worker%s%s\n", perf.steps, WIDTH, HEIGHT, perf.n_workers,
+               perf.n_workers == 1 ? "" : "s", scaled ? " (multiplexed, scaled estimates)" : "");
+        for (int e = 0; e < N_PERF; e++) {
+            if (!have[e]) { printf("  %-14s n/a\n", PERF_NAMES[e]); continue; }
+            printf("  %-14s %14.0f  %10.4f per cell\n", PERF_NAMES[e], total[e], total[e] / cells);
+        }
+        if (have[PERF_CYCLES] && have[PERF_INSTRUCTIONS] && total[PERF_CYCLES] > 0.0) {
+            printf("  IPC %.2f", total[PERF_INSTRUCTIONS] / total[PERF_CYCLES]);
+            if (have[PERF_LLC_MISSES]) printf(", %.1f LLC misses per 1k cells", 1e3 * total[PERF_LLC_MISSES] / cells);
+            if (have[PERF_DTLB_MISSES]) printf(", %.2f dTLB misses per 1k cells", 1e3 * total[PERF_DTLB_MISSES] / cells);
+            printf("\n");
+        }
+    }
+#ifdef __linux__
+    for (int i = 0; perf.fd && i < perf.n_workers * N_PERF; i++) if (perf.fd[i] >= 0) close(perf.fd[i]);
+#endif
+    free(perf.fd);
+    free(perf.leader);
+    memset(&perf, 0, sizeof(perf));
+}
+
+// --- Adaptive Time Step ---
+// With --adaptive, dt is re-chosen before every step (or time block) from the step
+// monitor: it may grow by at most ADAPT_GROWTH per block toward the stability limit
+// (speed_sq * dt^2 <= 0.5, with a safety margin, and 1 - damping * dt > 0) while the
+// field is calm, and drops at once to max|vel| * dt <= G_ADAPT_DH when waves steepen.
+#define ADAPT_SAFETY 0.9f        // Fraction of the stability limit used at most
+#define ADAPT_GROWTH 1.05f       // Largest dt increase between blocks
+#define ADAPT_MIN_FRACTION 0.01f // dt never drops below this fraction of --dt
+
+float G_BASE_DT = 0.0f;          // dt given on the command line (set at startup)
+float g_dt_min_used = 0.0f;      // Smallest/largest dt the controller has picked
+float g_dt_max_used = 0.0f;
+
+static float adaptive_dt(void) {
+    float limit = ADAPT_SAFETY * sqrtf(0.5f / G_WAVE_SPEED_SQ);
+    if (G_DAMPING > 0.0f) limit = fminf(limit, ADAPT_SAFETY / G_DAMPING);
+    float dt = g_max_vel > 0.0f ? fminf(limit, G_ADAPT_DH / g_max_vel) : limit;
+    dt = fminf(dt, G_DT * ADAPT_GROWTH);
+    dt = fmaxf(dt, G_BASE_DT * ADAPT_MIN_FRACTION);
+    if (g_dt_min_used == 0.0f || dt < g_dt_min_used) g_dt_min_used = dt;
+    if (dt > g_dt_max_used) g_dt_max_used = dt;
+    return dt;
+}
+
+// Advance the simulation by `steps` steps, in time blocks when --time-block > 1
+void simulation_advance(int steps) {
+    if (slab.n > 0) { // One command for the whole batch: the workers only sync halos
+        if (steps > 0) slab_advance(steps);
+        return;
+    }
+    while (steps > 0) {
+        int k = steps < G_TIME_BLOCK ? steps : G_TIME_BLOCK;
+        if (G_ADAPTIVE) G_DT = adaptive_dt();
+        perf_begin();
+        if (k <= 1) simulation_step(); else time_block_step(k);
+        perf_end(k);
+        steps -= k;
+    }
+}
+
+// Adaptive mode: advance by `duration` of simulated time. The last block is shortened
+// so the run lands on the target instead of overshooting it.
+void simulation_advance_time(double duration) {
+    double end = g_sim_time + duration;
+    while (end - g_sim_time > 1e-3 * G_BASE_DT) {
+        float dt = adaptive_dt();
+        double remaining = end - g_sim_time;
+        int k = G_TIME_BLOCK;
+        if (k * (double)dt >= remaining) {
+            k = (int)ceil(remaining / dt);
+            dt = (float)(remaining / k);
+        }
+        G_DT = dt;
+        perf_begin();
+        if (k <= 1) simulation_step(); else time_block_step(k);
+        perf_end(k);
+    }
+}
+
+// True once the run has hit --steps, --sim-time or an interrupt
+int run_finished(void) {
+    if (g_stop) return 1;
+    if (G_STEPS && g_step_count >= G_STEPS) return 1;
+    return G_SIM_TIME > 0.0 && G_SIM_TIME - g_sim_time <= 1e-3 * G_BASE_DT;
+}
+
+// Advance one frame (or headless chunk) worth of `nominal_steps` steps of --dt. Fixed
+// dt takes exactly that many steps (capped by --steps); adaptive mode covers the same
+// simulated time with however many steps the controller needs (capped by --sim-time).
+void advance_frame(double nominal_steps) {
+    STATS_BEGIN(t0);
+    if (G_ADAPTIVE) {
+        double duration = nominal_steps * G_BASE_DT;
+        if (G_SIM_TIME > 0.0 && g_sim_time + duration > G_SIM_TIME) duration = G_SIM_TIME - g_sim_time;
+        simulation_advance_time(duration);
+    } else {
+        long n = (long)nominal_steps;
+        if (G_STEPS && G_STEPS - g_step_count < n) n = (long)(G_STEPS - g_step_count);
+        simulation_advance((int)n);
+    }
+    STATS_END(PHASE_STEP, t0);
+}
+
+// Time `steps` steps with the current pool size (seconds)
+static double time_steps(int steps) {
+    double t0 = now_seconds();
+    simulation_advance(steps);
+    return now_seconds() - t0;
+}
+
+// Measure the speedup of the worker pool against one thread on the current grid and
+// print the strong-scaling efficiency. Leaves the simulation re-initialized.
+void report_thread_scaling(int n_workers) {
+    // Enough single-threaded steps for ~0.25s of work, but at least 3
+    int steps = 0;
+    double t1 = 0.0;
+    pool_stop();
+    G_DT = G_BASE_DT;
+    while (t1 < 0.25 || steps < 3) {
+        t1 += time_steps(G_TIME_BLOCK);
+        steps += G_TIME_BLOCK;
+    }
+    pool_start(n_workers);
+    G_DT = G_BASE_DT;
+    double tn = time_steps(steps);
+    double speedup = t1 / tn;
+    printf("Threads: %d, speedup %.2fx over 1 thread, strong-scaling efficiency %.0f%%\n",
+           n_workers, speedup, 100.0 * speedup / n_workers);
+    G_DT = G_BASE_DT;
+    initialize_simulation();
+}
+
+// Print wall time, steps/s and million lattice updates per second for a run
+void report_throughput(long steps, double seconds) {
+    double cells = (double)WIDTH * (double)HEIGHT;
+    double steps_per_s = seconds > 0.0 ? (double)steps / seconds : 0.0;
+    printf("Steps: %ld in %.3f s (%.1f steps/s, %.1f MLUPS)\n",
+           steps, seconds, steps_per_s, steps_per_s * cells / 1e6);
+    printf("Simulated time: %.3f (%.1f per second of wall time)", g_sim_time, seconds > 0.0 ? g_sim_time / seconds : 0.0);
+    if (G_ADAPTIVE && steps > 0) {
+        printf(", adaptive dt %.4f-%.4f, mean %.4f", g_dt_min_used, g_dt_max_used, g_sim_time / steps);
+    }
+    printf("\n");
+    if (G_ACTIVE_TILES && at.total > 0) {
+        printf("Active tiles: %.1f%% of tile steps computed (%dx%d tiles)\n",
+               100.0 * (double)at.stepped / (double)at.total, AT_TILE, AT_TILE);
+    }
+    if (G_INTEGRATOR == INTEGRATOR_IMPLICIT && ig.solves > 0) {
+        printf("Implicit: %.1f CG iterations per step (max %d), %d multigrid levels",
+               (double)ig.iterations / (double)ig.solves, ig.max_iterations, ig.n_levels);
+        if (ig.capped > 0) printf(", %lld steps stopped at the %d-iteration cap", ig.capped, IG_MAX_ITER);
+        printf("\n");
+    }
+}
+
+// Discrete wave energy of the current state: 1/2 vel^2 per water cell plus
+// 1/2 speed_sq (dh)^2 per pair of adjacent water cells, the quantity the 5-point
+// step conserves without damping. The highest water cell is stored in *max_h.
+double compute_energy(float *max_h) {
+    float *buf = NULL; // 16-bit storage: two widened h rows and a vel row
+    if (G_STORAGE != STORAGE_FP32) {
+        buf = (float *)malloc(3 * (size_t)WIDTH * sizeof(float));
+        if (!buf) return NAN;
+        STORAGE_CODECS[G_STORAGE].widen_h(buf, GRID_ROW(h16, 0), WIDTH);
+    }
+    double kinetic = 0.0, potential = 0.0;
+    float top = 0.0f;
+    for (int r = 0; r < HEIGHT; r++) {
+        const float *h_row, *h_below = NULL, *vel_row;
+        if (!buf) {
+            h_row = GRID_ROW(h, r);
+            if (r + 1 < HEIGHT) h_below = GRID_ROW(h, r + 1);
+            vel_row = GRID_ROW(vel, r);
+        } else {
+            float *cur = buf + (size_t)(r & 1) * WIDTH, *next = buf + (size_t)((r + 1) & 1) * WIDTH;
+            h_row = cur;
+            if (r + 1 < HEIGHT) {
+                STORAGE_CODECS[G_STORAGE].widen_h(next, GRID_ROW(h16, r + 1), WIDTH);
+                h_below = next;
+            }
+            STORAGE_CODECS[G_STORAGE].widen_vel(buf + 2 * (size_t)WIDTH, GRID_ROW(vel16, r), WIDTH);
+            vel_row = buf + 2 * (size_t)WIDTH;
+        }
+        for (int c = 0; c < WIDTH; c++) {
+            if (BITS_AT(obstacle, r, c)) continue;
+            kinetic += 0.5 * (double)vel_row[c] * vel_row[c];
+            top = fmaxf(top, h_row[c]);
+            if (c + 1 < WIDTH && !BITS_AT(obstacle, r, c + 1)) {
+                double d = (double)h_row[c + 1] - h_row[c];
+                potential += d * d;
+            }
+            if (h_below && !BITS_AT(obstacle, r + 1, c)) {
+                double d = (double)h_below[c] - h_row[c];
+                potential += d * d;
+            }
+        }
+    }
+    free(buf);
+    if (max_h) *max_h = top;
+    return kinetic + 0.5 * G_WAVE_SPEED_SQ * potential;
+}
+
+char height_to_char(float current_h);
+
+// Re-run the same simulation with fp32 fields and report how far the 16-bit result
+// has drifted from it. Fixed dt replays the same number of steps, adaptive mode the
+// same simulated time. Leaves the simulation in fp32 mode.
+void report_storage_error(void) {
+    const int mode = G_STORAGE;
+    const long long steps = g_step_count;
+    const double sim_time = g_sim_time;
+
+    G_STORAGE = STORAGE_FP32;
+    int ok = grid_f_alloc(&h, WIDTH, HEIGHT);
+    ok = grid_f_alloc(&vel, WIDTH, HEIGHT) && ok;
+    ok = grid_f_alloc(&next_h, WIDTH, HEIGHT) && ok;
+    ok = grid_f_alloc(&next_vel, WIDTH, HEIGHT) && ok;
+    float *row = (float *)malloc(2 * (size_t)WIDTH * sizeof(float));
+    if (!ok || !row) {
+        fprintf(stderr, "Error: not enough memory for the fp32 reference run.\n");
+        free(row);
+        return;
+    }
+    G_DT = G_BASE_DT;
+    initialize_simulation();
+    if (G_ADAPTIVE) {
+        simulation_advance_time(sim_time);
+    } else {
+        while (g_step_count < steps) {
+            long long left = steps - g_step_count;
+            simulation_advance(left < (1 << 20) ? (int)left : (1 << 20));
+        }
+    }
+
+    double h_max = 0.0, h_sq = 0.0, vel_max = 0.0, vel_sq = 0.0;
+    long long cells = 0, glyphs_changed = 0;
+    for (int r = 0; r < HEIGHT; r++) {
+        STORAGE_CODECS[mode].widen_h(row, GRID_ROW(h16, r), WIDTH);
+        STORAGE_CODECS[mode].widen_vel(row + WIDTH, GRID_ROW(vel16, r), WIDTH);
+        for (int c = 0; c < WIDTH; c++) {
+            if (BITS_AT(obstacle, r, c)) continue;
+            double dh = fabs((double)row[c] - GRID_AT(h, r, c));
+            double dv = fabs((double)row[WIDTH + c] - GRID_AT(vel, r, c));
+            h_max = fmax(h_max, dh); h_sq += dh * dh;
+            vel_max = fmax(vel_max, dv); vel_sq += dv * dv;
+            glyphs_changed += height_to_char(row[c]) != height_to_char(GRID_AT(h, r, c));
+            cells++;
+        }
+    }
+    free(row);
+    if (cells == 0) cells = 1;
+    printf("Storage %s vs fp32 reference after %lld steps: h max err %.3e (rms %.3e), "
+           "vel max err %.3e (rms %.3e), %.2f%% of cells drawn differently\n",
+           STORAGE_CODECS[mode].name, steps, h_max, sqrt(h_sq / cells), vel_max, sqrt(vel_sq / cells),
+           100.0 * (double)glyphs_changed / (double)cells);
+}
+
+// --- Quantizer ---
+// A height is drawn as one of seven glyphs: its level is the number of thresholds it
+// exceeds, and the level indexes HEIGHT_GLYPHS. There are no branches, so the row
+// quantizer below can do the same for 32 cells at once with compare masks and a
+// byte shuffle. A NaN exceeds no threshold and is drawn as ' '.
+static const float HEIGHT_THRESHOLDS[6] = { 0.05f, 0.20f, 0.35f, 0.50f, 0.65f, 0.80f };
+static const char HEIGHT_GLYPHS[16] = " .-=*#@"; // Level 3 ('=') is about the default --level
+
+// Convert water height (0.0 to 1.0) to an ASCII character
+char height_to_char(float current_h) {
+    int level = (current_h > HEIGHT_THRESHOLDS[0]) + (current_h > HEIGHT_THRESHOLDS[1]) +
+                (current_h > HEIGHT_THRESHOLDS[2]) + (current_h > HEIGHT_THRESHOLDS[3]) +
+                (current_h > HEIGHT_THRESHOLDS[4]) + (current_h > HEIGHT_THRESHOLDS[5]);
+    return HEIGHT_GLYPHS[level];
+}
+
+// Quantize a row of n heights into out ('X' where the obstacle bit is set) and return
+// how many cells differ from prev
+typedef size_t (*quantize_row_fn)(char *out, const char *prev, const float *h_row, const uint64_t *obs_row, int n);
+
+// Cells [c0, n) of a row
+static size_t quantize_cells(char *out, const char *prev, const float *h_row, const uint64_t *obs_row, int c0, int n) {
+    size_t changed = 0;
+    for (int c = c0; c < n; c++) {
+        // One word covers 64 cells: all-water words skip the per-cell bit test
+        uint64_t walls = obs_row[c >> 6];
+        char glyph = (walls && ((walls >> (c & 63)) & 1)) ? 'X' : height_to_char(h_row[c]);
+        changed += glyph != prev[c];
+        out[c] = glyph;
+    }
+    return changed;
+}
+
+static size_t quantize_row_scalar(char *out, const char *prev, const float *h_row, const uint64_t *obs_row, int n) {
+    return quantize_cells(out, prev, h_row, obs_row, 0, n);
+}
+
+#ifdef CFD_X86_SIMD
+// Level of 8 heights as 32-bit lanes, negated (each exceeded threshold adds -1)
+__attribute__((target("avx2")))
+static inline __m256i quantize_levels8(const float *h) {
+    __m256 v = _mm256_loadu_ps(h);
+    __m256i sum = _mm256_castps_si256(_mm256_cmp_ps(v, _mm256_set1_ps(HEIGHT_THRESHOLDS[0]), _CMP_GT_OQ));
+    for (int t = 1; t < 6; t++) {
+        sum = _mm256_add_epi32(sum, _mm256_castps_si256(_mm256_cmp_ps(v, _mm256_set1_ps(HEIGHT_THRESHOLDS[t]), _CMP_GT_OQ)));
+    }
+    return sum;
+}
+
+__attribute__((target("avx2")))
+static size_t quantize_row_avx2(char *out, const char *prev, const float *h_row, const uint64_t *obs_row, int n) {
+    const __m256i glyphs = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)HEIGHT_GLYPHS));
+    const __m256i wall_glyph = _mm256_set1_epi8('X');
+    // Byte i of a 32-cell block tests bit (i & 7) of mask byte i / 8
+    const __m256i spread = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                            2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i bit = _mm256_set1_epi64x((long long)0x8040201008040201ULL);
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7); // Undo the in-lane packs
+    size_t changed = 0;
+    int c = 0;
+    for (; c + 32 <= n; c += 32) {
+        __m256i ab = _mm256_packs_epi32(quantize_levels8(h_row + c), quantize_levels8(h_row + c + 8));
+        __m256i cd = _mm256_packs_epi32(quantize_levels8(h_row + c + 16), quantize_levels8(h_row + c + 24));
+        __m256i levels = _mm256_sub_epi8(_mm256_setzero_si256(),
+                                         _mm256_permutevar8x32_epi32(_mm256_packs_epi16(ab, cd), order));
+        __m256i row = _mm256_shuffle_epi8(glyphs, levels);
+        uint32_t walls = (uint32_t)(obs_row[c >> 6] >> (c & 63));
+        if (walls) {
+            __m256i m = _mm256_shuffle_epi8(_mm256_set1_epi32((int)walls), spread);
+            m = _mm256_cmpeq_epi8(_mm256_and_si256(m, bit), bit);
+            row = _mm256_blendv_epi8(row, wall_glyph, m);
+        }
+        __m256i same = _mm256_cmpeq_epi8(row, _mm256_loadu_si256((const __m256i *)(prev + c)));
+        changed += 32 - (size_t)__builtin_popcount((unsigned)_mm256_movemask_epi8(same));
+        _mm256_storeu_si256((__m256i *)(out + c), row);
+    }
+    return changed + quantize_cells(out, prev, h_row, obs_row, c, n);
+}
+#endif // CFD_X86_SIMD
+
+quantize_row_fn quantize_row = quantize_row_scalar;
+
+// Use the AVX2 row quantizer unless the scalar kernel was asked for
+void select_quantizer(int kernel) {
+#ifdef CFD_X86_SIMD
+    if (kernel != KERNEL_SCALAR && __builtin_cpu_supports("avx2")) quantize_row = quantize_row_avx2;
+#else
+    (void)kernel;
+#endif
+}
+
+// --- Map Loading ---
+// --map starts the run from a file instead of the default tank: a binary PGM (P5,
+// 8 or 16 bit; 0 is wall, any other value v is water of height v / maxval) or plain
+// ASCII drawn with the renderer's own glyphs ('X' is wall, ' ' . - = * # @ are water
+// at the middle of the height band they stand for; short lines are padded with ' ').
+// The file is mapped, never read through stdio: ASCII lines are indexed by the pool
+// in byte bands, and initialize_simulation() converts rows in parallel straight into
+// the grids. The border ring is always wall. The mapping is kept for the whole run
+// because the thread-scaling and storage reports re-initialize from it.
+#define MAP_WALL  -1.0f  // Decoded cell is a wall
+#define MAP_BAD   -2.0f  // Decoded cell is not a valid glyph
+
+static struct {
+    const unsigned char *bytes;  // File contents
+    size_t len;
+    int mapped;                  // bytes is an mmap (else a malloc'd copy)
+    int width, height;
+    int pgm_bytes;               // PGM: bytes per sample (1 or 2); 0 for ASCII
+    int maxval;                  // PGM: value of a full cell
+    size_t data_offset;          // PGM: first sample
+    size_t *line_start;          // ASCII: byte offset of each line, plus one past the last
+    float lut[256];              // 8-bit PGM sample or ASCII glyph -> height, MAP_WALL or MAP_BAD
+} map_file;
+
+// Skip whitespace and '#' comments, then parse a decimal PGM header field
+static int pgm_field(const unsigned char *p, size_t len, size_t *pos, int *value) {
+    for (;;) {
+        while (*pos < len && (p[*pos] == ' ' || p[*pos] == '\t' || p[*pos] == '\n' || p[*pos] == '\r')) (*pos)++;
+        if (*pos < len && p[*pos] == '#') {
+            while (*pos < len && p[*pos] != '\n') (*pos)++;
+        } else {
+            break;
+        }
+    }
+    long v = 0;
+    size_t start = *pos;
+    while (*pos < len && p[*pos] >= '0' && p[*pos] <= '9' && v <= 1L << 30) v = v * 10 + (p[(*pos)++] - '0');
+    *value = (int)v;
+    return *pos > start && v <= 1L << 30;
+}
+
+typedef struct {
+    size_t *newlines;   // Per worker: newlines in its byte band
+} map_index_args;
+
+// Byte band of `worker` over the whole file
+static void map_byte_band(int worker, int n_workers, size_t *b0, size_t *b1) {
+    *b0 = (size_t)((unsigned long long)map_file.len * worker / n_workers);
+    *b1 = (size_t)((unsigned long long)map_file.len * (worker + 1) / n_workers);
+}
+
+static void map_count_job(void *arg, int worker, int n_workers) {
+    map_index_args *a = (map_index_args *)arg;
+    size_t b0, b1, n = 0;
+    map_byte_band(worker, n_workers, &b0, &b1);
+    const unsigned char *p = map_file.bytes + b0, *end = map_file.bytes + b1;
+    while (p < end && (p = (const unsigned char *)memchr(p, '\n', (size_t)(end - p))) != NULL) { n++; p++; }
+    a->newlines[worker] = n;
+}
+
+// Second pass: each worker records the starts of the lines following its newlines;
+// a->newlines now holds the index of its first such line
+static void map_index_job(void *arg, int worker, int n_workers) {
+    map_index_args *a = (map_index_args *)arg;
+    size_t b0, b1, line = a->newlines[worker];
+    map_byte_band(worker, n_workers, &b0, &b1);
+    const unsigned char *base = map_file.bytes;
+    const unsigned char *p = base + b0, *end = base + b1;
+    while (p < end && (p = (const unsigned char *)memchr(p, '\n', (size_t)(end - p))) != NULL) {
+        map_file.line_start[++line] = (size_t)(++p - base);
+    }
+}
+
+// Index the lines of an ASCII map and size the grid from them
+static const char *map_index_ascii(void) {
+    int n_workers = pool_size();
+    map_index_args a;
+    a.newlines = (size_t *)calloc((size_t)n_workers, sizeof(size_t));
+    if (!a.newlines) return "out of memory";
+    pool_run(map_count_job, &a);
+    size_t lines = 0;
+    for (int w = 0; w < n_workers; w++) {
+        size_t n = a.newlines[w];
+        a.newlines[w] = lines;
+        lines += n;
+    }
+    int unterminated = map_file.bytes[map_file.len - 1] != '\n';
+    lines += unterminated;
+    if (lines > INT32_MAX) { free(a.newlines); return "too many lines"; }
+    map_file.line_start = (size_t *)malloc((lines + 1) * sizeof(size_t));
+    if (!map_file.line_start) { free(a.newlines); return "out of memory"; }
+    map_file.line_start[0] = 0;
+    pool_run(map_index_job, &a);
+    free(a.newlines);
+    // As if the last line ended in a newline, so every line is [start, next start - 1)
+    if (unterminated) map_file.line_start[lines] = map_file.len + 1;
+
+    size_t width = 0;
+    for (size_t i = 0; i < lines; i++) {
+        size_t n = map_file.line_start[i + 1] - map_file.line_start[i] - 1;
+        if (n > 0 && map_file.bytes[map_file.line_start[i] + n - 1] == '\r') n--;
+        if (n > width) width = n;
+    }
+    if (width > INT32_MAX) return "lines too long";
+    map_file.width = (int)width;
+    map_file.height = (int)lines;
+
+    for (int i = 0; i < 256; i++) map_file.lut[i] = MAP_BAD;
+    map_file.lut['X'] = MAP_WALL;
+    // The middle of each height_to_char() band, so a map drawn from a frame reloads as drawn
+    map_file.lut[' '] = 0.0f;
+    map_file.lut['.'] = 0.125f;
+    map_file.lut['-'] = 0.275f;
+    map_file.lut['='] = 0.425f;
+    map_file.lut['*'] = 0.575f;
+    map_file.lut['#'] = 0.725f;
+    map_file.lut['@'] = 0.9f;
+    return NULL;
+}
+
+static const char *map_parse_pgm(void) {
+    size_t pos = 2;
+    int w, h, maxval;
+    if (!pgm_field(map_file.bytes, map_file.len, &pos, &w) || !pgm_field(map_file.bytes, map_file.len, &pos, &h) ||
+        !pgm_field(map_file.bytes, map_file.len, &pos, &maxval) || pos >= map_file.len) {
+        return "malformed PGM header";
+    }
+    if (maxval < 1 || maxval > 65535) return "PGM maxval must be 1-65535";
+    map_file.width = w;
+    map_file.height = h;
+    map_file.maxval = maxval;
+    map_file.pgm_bytes = maxval < 256 ? 1 : 2;
+    map_file.data_offset = pos + 1; // A single whitespace byte ends the header
+    if ((map_file.len - map_file.data_offset) / map_file.pgm_bytes / (w ? (size_t)w : 1) < (size_t)h) {
+        return "PGM data is truncated";
+    }
+    map_file.lut[0] = MAP_WALL;
+    for (int i = 1; i < 256; i++) map_file.lut[i] = fminf(1.0f, (float)i / (float)maxval);
+    return NULL;
+}
+
+void map_close(void) {
+#ifndef _WIN32
+    if (map_file.mapped) munmap((void *)map_file.bytes, map_file.len);
+    else
+#endif
+    free((void *)map_file.bytes);
+    free(map_file.line_start);
+    memset(&map_file, 0, sizeof(map_file));
+}
+
+// Map `path` and work out its format and grid size (map_file.width x height); the
+// cells are converted later by initialize_simulation(). Uses the running pool.
+// Returns 1 on success; on failure prints why and returns 0.
+int map_open(const char *path) {
+    const char *problem = NULL;
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Error: could not open map '%s': %s\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+    map_file.len = (size_t)st.st_size;
+    if (map_file.len > 0) {
+        void *p = mmap(NULL, map_file.len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            fprintf(stderr, "Error: could not map '%s': %s\n", path, strerror(errno));
+            close(fd);
+            return 0;
+        }
+        posix_madvise(p, map_file.len, POSIX_MADV_WILLNEED); // Start read-ahead for the workers
+        map_file.bytes = (const unsigned char *)p;
+        map_file.mapped = 1;
+    }
+    close(fd);
+#else // No mmap: read the file in one go
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Error: could not open map '%s'.\n", path);
+        return 0;
+    }
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    unsigned char *buf = n > 0 ? (unsigned char *)malloc((size_t)n) : NULL;
+    if (buf && fread(buf, 1, (size_t)n, f) == (size_t)n) {
+        map_file.bytes = buf;
+        map_file.len = (size_t)n;
+    } else {
+        free(buf);
+    }
+    fclose(f);
+#endif
+    if (map_file.len == 0) problem = "file is empty";
+    else if (map_file.len >= 2 && map_file.bytes[0] == 'P' && map_file.bytes[1] == '5') problem = map_parse_pgm();
+    else problem = map_index_ascii();
+    if (!problem && (map_file.width < 3 || map_file.height < 3)) problem = "map must be at least 3x3";
+    if (problem) {
+        fprintf(stderr, "Error: cannot load map '%s': %s.\n", path, problem);
+        map_close();
+        return 0;
+    }
+    return 1;
+}
+
+// Height of each cell of map row r (MAP_WALL / MAP_BAD as decoded)
+static void map_decode_row(int r, float *out) {
+    if (map_file.pgm_bytes == 1) {
+        const unsigned char *src = map_file.bytes + map_file.data_offset + (size_t)r * WIDTH;
+        for (int c = 0; c < WIDTH; c++) out[c] = map_file.lut[src[c]];
+    } else if (map_file.pgm_bytes == 2) {
+        const unsigned char *src = map_file.bytes + map_file.data_offset + (size_t)r * WIDTH * 2;
+        float scale = 1.0f / (float)map_file.maxval;
+        for (int c = 0; c < WIDTH; c++) {
+            int v = (src[2 * c] << 8) | src[2 * c + 1]; // Big-endian samples
+            out[c] = v == 0 ? MAP_WALL : fminf(1.0f, (float)v * scale);
+        }
+    } else {
+        const unsigned char *src = map_file.bytes + map_file.line_start[r];
+        int n = (int)(map_file.line_start[r + 1] - map_file.line_start[r] - 1);
+        if (n > 0 && src[n - 1] == '\r') n--;
+        for (int c = 0; c < n; c++) out[c] = map_file.lut[src[c]];
+        for (int c = n; c < WIDTH; c++) out[c] = 0.0f;
+    }
+}
+
+typedef struct {
+    float *rows;           // Per worker: decoded row, plus h and vel rows for 16-bit storage
+    long long *first_bad;  // Per worker: first invalid cell as r * WIDTH + c (-1 if none)
+} map_convert_args;
+
+static void map_convert_job(void *arg, int worker, int n_workers) {
+    map_convert_args *a = (map_convert_args *)arg;
+    float *decoded = a->rows + (size_t)worker * 3 * WIDTH;
+    int r0, r1;
+    pool_band(HEIGHT, worker, n_workers, &r0, &r1);
+    a->first_bad[worker] = -1;
+    for (int r = r0; r < r1; r++) {
+        float *h_row = G_STORAGE == STORAGE_FP32 ? GRID_ROW(h, r) : decoded + WIDTH;
+        float *vel_row = G_STORAGE == STORAGE_FP32 ? GRID_ROW(vel, r) : decoded + 2 * WIDTH;
+        uint64_t *bits = BITS_ROW(obstacle, r);
+        uint64_t word = 0;
+        int bad = 0;
+        map_decode_row(r, decoded);
+        // The border ring is wall whatever the map says
+        if (r == 0 || r == HEIGHT - 1) {
+            for (int c = 0; c < WIDTH; c++) {
+                bad |= decoded[c] == MAP_BAD;
+                decoded[c] = MAP_WALL;
+            }
+        }
+        bad |= decoded[0] == MAP_BAD || decoded[WIDTH - 1] == MAP_BAD;
+        decoded[0] = decoded[WIDTH - 1] = MAP_WALL;
+        for (int c = 0; c < WIDTH; c++) {
+            float v = decoded[c];
+            int wall = v < 0.0f; // MAP_BAD too; the run is abandoned below anyway
+            bad |= v == MAP_BAD;
+            h_row[c] = wall ? 0.0f : v;
+            vel_row[c] = 0.0f;
+            word |= (uint64_t)wall << (c & 63);
+            if ((c & 63) == 63 || c == WIDTH - 1) {
+                bits[c >> 6] = word;
+                word = 0;
+            }
+        }
+        if (bad && a->first_bad[worker] < 0) {
+            map_decode_row(r, decoded);
+            int c = 0;
+            while (decoded[c] != MAP_BAD) c++;
+            a->first_bad[worker] = (long long)r * WIDTH + c;
+        }
+        if (G_STORAGE != STORAGE_FP32) storage_store_row(r, h_row, vel_row);
+    }
+}
+
+// Fill the grids from the open map (the --map branch of initialize_simulation())
+void map_convert(void) {
+    int n_workers = pool_size();
+    map_convert_args a;
+    a.rows = (float *)malloc((size_t)n_workers * 3 * WIDTH * sizeof(float));
+    a.first_bad = (long long *)malloc((size_t)n_workers * sizeof(long long));
+    if (!a.rows || !a.first_bad) {
+        fprintf(stderr, "Error: Memory allocation failed for initial state.\n");
+        exit(EXIT_FAILURE);
+    }
+    pool_run(map_convert_job, &a);
+    for (int w = 0; w < n_workers; w++) {
+        if (a.first_bad[w] < 0) continue;
+        int r = (int)(a.first_bad[w] / WIDTH), c = (int)(a.first_bad[w] % WIDTH);
+        unsigned char glyph = map_file.bytes[map_file.line_start[r] + c];
+        fprintf(stderr, "Error: map line %d, column %d: '%c' is not a map glyph (X or one of \" .-=*#@\").\n",
+                r + 1, c + 1, glyph >= 32 && glyph < 127 ? glyph : '?');
+        exit(EXIT_FAILURE);
+    }
+    free(a.rows);
+    free(a.first_bad);
+}
+
+// --- Checkpoints ---
+// A checkpoint holds a one-page header followed by the raw h, vel and obstacle blocks,
+// each starting on a CKPT_ALIGN boundary and laid out exactly as in memory (padded
+// rows, the run's storage format). Restoring maps the file once with MAP_PRIVATE
+// and points the grids straight into the mapping: nothing is parsed or copied, and
+// pages are only read in (and copied on first write) as the step touches them.
+#define CKPT_MAGIC "CFDCKPT"
+#define CKPT_VERSION 1
+#define CKPT_ALIGN 16384        // Covers 4 KiB and 16 KiB pages
+#define CKPT_BYTE_ORDER 0x01020304u
+
+typedef struct {
+    char magic[8];              // CKPT_MAGIC
+    uint32_t version;           // CKPT_VERSION
+    uint32_t byte_order;        // CKPT_BYTE_ORDER as stored by the writing host
+    int32_t width, height;
+    int32_t storage;            // STORAGE_* of the h and vel blocks
+    int32_t reserved;
+    float dt;                   // dt in use when written (differs from base_dt in adaptive mode)
+    float base_dt;              // --dt of the run
+    float speed_sq, damping;
+    int64_t step_count;
+    double sim_time;
+    float max_vel;
+    int32_t reserved2;
+    uint64_t field_stride;      // Elements per row of h and vel
+    uint64_t obstacle_stride;   // Words per row of the obstacle bits
+    uint64_t h_offset, vel_offset, obstacle_offset; // File offsets, CKPT_ALIGN-aligned
+    uint64_t file_bytes;
+} ckpt_header;
+
+static long long ckpt_next_step = 0; // Step count at which the next periodic checkpoint is due
+
+static uint64_t ckpt_round_up(uint64_t n) { return (n + CKPT_ALIGN - 1) / CKPT_ALIGN * CKPT_ALIGN; }
+
+// Field and obstacle layout of the current grid
+static void ckpt_layout(ckpt_header *hd) {
+    size_t elem = G_STORAGE == STORAGE_FP32 ? sizeof(float) : sizeof(uint16_t);
+    hd->field_stride = grid_stride(WIDTH, elem);
+    hd->obstacle_stride = grid_stride((WIDTH + 63) / 64, sizeof(uint64_t));
+    uint64_t field_bytes = hd->field_stride * (uint64_t)HEIGHT * elem;
+    hd->h_offset = CKPT_ALIGN;
+    hd->vel_offset = hd->h_offset + ckpt_round_up(field_bytes);
+    hd->obstacle_offset = hd->vel_offset + ckpt_round_up(field_bytes);
+    hd->file_bytes = hd->obstacle_offset + ckpt_round_up(hd->obstacle_stride * (uint64_t)HEIGHT * sizeof(uint64_t));
+}
+
+#ifndef _WIN32
+// pwrite() all of buf, retrying short writes and EINTR
+static int ckpt_pwrite_all(int fd, const void *buf, size_t len, off_t off) {
+    const char *p = (const char *)buf;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        p += n; off += n; len -= (size_t)n;
+    }
+    return 1;
+}
+
+// Write the current state to `path` (via a temporary file renamed into place, so an
+// interrupted write never leaves a truncated checkpoint). Returns 1 on success.
+int checkpoint_write(const char *path) {
+    static char header_page[CKPT_ALIGN];
+    ckpt_header hd;
+    memset(&hd, 0, sizeof(hd));
+    memcpy(hd.magic, CKPT_MAGIC, sizeof(CKPT_MAGIC));
+    hd.version = CKPT_VERSION;
+    hd.byte_order = CKPT_BYTE_ORDER;
+    hd.width = WIDTH;
+    hd.height = HEIGHT;
+    hd.storage = G_STORAGE;
+    hd.dt = G_DT;
+    hd.base_dt = G_BASE_DT;
+    hd.speed_sq = G_WAVE_SPEED_SQ;
+    hd.damping = G_DAMPING;
+    hd.step_count = g_step_count;
+    hd.sim_time = g_sim_time;
+    hd.max_vel = g_max_vel;
+    ckpt_layout(&hd);
+
+    const void *h_data = G_STORAGE == STORAGE_FP32 ? (const void *)h.data : (const void *)h16.data;
+    const void *vel_data = G_STORAGE == STORAGE_FP32 ? (const void *)vel.data : (const void *)vel16.data;
+    size_t elem = G_STORAGE == STORAGE_FP32 ? sizeof(float) : sizeof(uint16_t);
+    size_t field_bytes = (size_t)hd.field_stride * HEIGHT * elem;
+
+    size_t tmp_len = strlen(path) + 5;
+    char *tmp = (char *)malloc(tmp_len);
+    if (!tmp) return 0;
+    snprintf(tmp, tmp_len, "%s.tmp", path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int ok = fd >= 0;
+    memcpy(header_page, &hd, sizeof(hd));
+    ok = ok && ftruncate(fd, (off_t)hd.file_bytes) == 0;
+    ok = ok && ckpt_pwrite_all(fd, header_page, sizeof(header_page), 0);
+    ok = ok && ckpt_pwrite_all(fd, h_data, field_bytes, (off_t)hd.h_offset);
+    ok = ok && ckpt_pwrite_all(fd, vel_data, field_bytes, (off_t)hd.vel_offset);
+    ok = ok && ckpt_pwrite_all(fd, obstacle.words, hd.obstacle_stride * (size_t)HEIGHT * sizeof(uint64_t),
+                               (off_t)hd.obstacle_offset);
+    ok = ok && fsync(fd) == 0;
+    if (fd >= 0 && close(fd) != 0) ok = 0;
+    ok = ok && rename(tmp, path) == 0;
+    if (!ok) {
+        fprintf(stderr, "Error: could not write checkpoint '%s': %s\n", path, strerror(errno));
+        unlink(tmp);
+    }
+    free(tmp);
+    return ok;
+}
+
+// Map `path` and make it the simulation state: grid size, physics parameters, run
+// state and the h/vel/obstacle grids. Replaces allocate_grids() + initialize_simulation().
+// Returns 1 on success; on failure prints why and returns 0.
+int checkpoint_restore(const char *path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Error: could not open checkpoint '%s': %s\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+    if ((size_t)st.st_size < sizeof(ckpt_header)) {
+        fprintf(stderr, "Error: '%s' is not a checkpoint (too short).\n", path);
+        close(fd);
+        return 0;
+    }
+    char *map = (char *)mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping keeps the file open
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Error: could not map checkpoint '%s': %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    ckpt_header hd, expect;
+    memcpy(&hd, map, sizeof(hd));
+    const char *problem = NULL;
+    if (memcmp(hd.magic, CKPT_MAGIC, sizeof(CKPT_MAGIC)) != 0) problem = "not a checkpoint";
+    else if (hd.byte_order != CKPT_BYTE_ORDER) problem = "written on a host with another byte order";
+    else if (hd.version != CKPT_VERSION) problem = "unsupported version";
+    else if (hd.width < 3 || hd.height < 3 || hd.storage < 0 || hd.storage >= N_STORAGE) problem = "corrupt header";
+    if (!problem) {
+        WIDTH = hd.width;
+        HEIGHT = hd.height;
+        G_STORAGE = hd.storage;
+        ckpt_layout(&expect);
+        if (expect.field_stride != hd.field_stride || expect.obstacle_stride != hd.obstacle_stride ||
+            expect.h_offset != hd.h_offset || expect.vel_offset != hd.vel_offset ||
+            expect.obstacle_offset != hd.obstacle_offset || expect.file_bytes != hd.file_bytes) {
+            problem = "layout does not match this build";
+        } else if ((uint64_t)st.st_size < hd.file_bytes) {
+            problem = "file is truncated";
+        }
+    }
+    if (problem) {
+        fprintf(stderr, "Error: cannot restore '%s': %s.\n", path, problem);
+        munmap(map, (size_t)st.st_size);
+        return 0;
+    }
+
+    restore_map = map;
+    restore_map_bytes = (size_t)st.st_size;
+    int ok = 1;
+    if (G_STORAGE == STORAGE_FP32) {
+        h.data = (float *)(map + hd.h_offset);
+        vel.data = (float *)(map + hd.vel_offset);
+        h.width = vel.width = WIDTH;
+        h.height = vel.height = HEIGHT;
+        h.stride = vel.stride = (size_t)hd.field_stride;
+        ok = grid_f_alloc(&next_h, WIDTH, HEIGHT) && grid_f_alloc(&next_vel, WIDTH, HEIGHT);
+    } else {
+        h16.data = (uint16_t *)(map + hd.h_offset);
+        vel16.data = (uint16_t *)(map + hd.vel_offset);
+        h16.width = vel16.width = WIDTH;
+        h16.height = vel16.height = HEIGHT;
+        h16.stride = vel16.stride = (size_t)hd.field_stride;
+        ok = grid_u16_alloc(&next_h16, WIDTH, HEIGHT) && grid_u16_alloc(&next_vel16, WIDTH, HEIGHT);
+    }
+    obstacle.words = (uint64_t *)(map + hd.obstacle_offset);
+    obstacle.width = WIDTH;
+    obstacle.height = HEIGHT;
+    obstacle.stride = (size_t)hd.obstacle_stride;
+    if (!ok) {
+        fprintf(stderr, "Error: Memory allocation failed for %dx%d grid.\n", WIDTH, HEIGHT);
+        free_grids();
+        exit(EXIT_FAILURE);
+    }
+    VIEW_W = WIDTH;
+    VIEW_H = HEIGHT;
+
+    G_DT = hd.dt;
+    G_BASE_DT = hd.base_dt;
+    G_WAVE_SPEED_SQ = hd.speed_sq;
+    G_DAMPING = hd.damping;
+    build_step_plan();
+    g_step_count = hd.step_count;
+    g_sim_time = hd.sim_time;
+    g_max_vel = hd.max_vel;
+    return 1;
+}
+
+void checkpoint_unmap(void) {
+    if (!restore_map) return;
+    munmap(restore_map, restore_map_bytes);
+    restore_map = NULL;
+    restore_map_bytes = 0;
+}
+#else // No mmap/pwrite: checkpoints are not available
+int checkpoint_write(const char *path) { (void)path; return 0; }
+int checkpoint_restore(const char *path) {
+    fprintf(stderr, "Error: cannot restore '%s': checkpoints are not supported on this platform.\n", path);
+    return 0;
+}
+void checkpoint_unmap(void) {}
+#endif
+
+// Write a periodic checkpoint if one is due (--checkpoint-every)
+void checkpoint_tick(void) {
+    if (G_CHECKPOINT_EVERY <= 0 || g_step_count < ckpt_next_step) return;
+    if (ckpt_next_step > 0) {
+        double t0 = now_seconds();
+        if (checkpoint_write(G_CHECKPOINT_FILE) && G_HEADLESS) {
+            printf("Checkpoint: step %lld -> %s (%.0f ms)\n", g_step_count, G_CHECKPOINT_FILE, (now_seconds() - t0) * 1e3);
+        }
+        STATS_END(PHASE_CHECKPOINT, t0);
+    }
+    ckpt_next_step = (g_step_count / G_CHECKPOINT_EVERY + 1) * G_CHECKPOINT_EVERY;
+}
+
+// Final checkpoint at the end of a run, so a finished or interrupted run can be resumed
+void checkpoint_final(void) {
+    if (G_CHECKPOINT_EVERY > 0 && checkpoint_write(G_CHECKPOINT_FILE) && G_HEADLESS) {
+        printf("Checkpoint: step %lld -> %s\n", g_step_count, G_CHECKPOINT_FILE);
+    }
+}
+
+// --- Parameter Sweep ---
+// --sweep name=start:stop:step (repeatable) runs every combination of the swept
+// parameters as its own headless simulation and writes one CSV row per run. The
+// runs are handed out one at a time to worker processes forked from this one (one
+// per core, divided by --threads), so there is no per-run process start, argument
+// parsing or terminal probing, and a loaded --map is shared between them. Each
+// worker asks for the next run by reporting the result of its last one.
+#define SWEEP_MAX_AXES 8
+#define SWEEP_MAX_RUNS 1000000
+
+typedef struct {
+    const char *name;
+    float *value;
+    float lo, hi;       // Allowed range (as checked by main())
+    int lo_open;        // lo itself is not allowed
+} sweep_param;
+
+static const sweep_param SWEEP_PARAMS[] = {
+    { "dt", &G_DT, 0.0f, INFINITY, 1 },
+    { "speed_sq", &G_WAVE_SPEED_SQ, 0.0f, INFINITY, 1 },
+    { "damping", &G_DAMPING, 0.0f, INFINITY, 0 },
+    { "level", &G_INITIAL_WATER_LEVEL, 0.0f, 1.0f, 0 },
+    { "tilt", &G_INITIAL_TILT, 0.0f, 1.0f, 0 },
+};
+#define N_SWEEP_PARAMS ((int)(sizeof(SWEEP_PARAMS) / sizeof(SWEEP_PARAMS[0])))
+
+typedef struct {
+    int param;          // Index into SWEEP_PARAMS
+    double start, step;
+    int n;              // Values start, start + step, ... (n of them, stop included)
+} sweep_axis;
+
+static sweep_axis sweep_axes[SWEEP_MAX_AXES];
+static int sweep_n_axes = 0;
+
+typedef struct {
+    int32_t worker;
+    int32_t run;
+    int32_t complete;   // 0 if the run was cut short by SIGINT/SIGTERM
+    float max_h;
+    int64_t steps;
+    double sim_time, energy, seconds;
+} sweep_result;
+
+// Parse one --sweep argument; returns 0 (after printing why) if it is invalid
+int sweep_add_axis(const char *spec) {
+    char name[32];
+    double start, stop, step;
+    int len = 0;
+    if (sscanf(spec, "%31[^=]=%lf:%lf:%lf%n", name, &start, &stop, &step, &len) != 4 || spec[len] != '\0') {
+        fprintf(stderr, "Error: --sweep expects name=start:stop:step, got '%s'.\n", spec);
+        return 0;
+    }
+    int param = -1;
+    for (int i = 0; i < N_SWEEP_PARAMS; i++) {
+        if (strcmp(name, SWEEP_PARAMS[i].name) == 0) param = i;
+    }
+    if (param < 0) {
+        fprintf(stderr, "Error: cannot sweep '%s' (dt, speed_sq, damping, level or tilt).\n", name);
+        return 0;
+    }
+    for (int i = 0; i < sweep_n_axes; i++) {
+        if (sweep_axes[i].param == param) { fprintf(stderr, "Error: '%s' is swept twice.\n", name); return 0; }
+    }
+    if (sweep_n_axes == SWEEP_MAX_AXES) { fprintf(stderr, "Error: at most %d swept parameters.\n", SWEEP_MAX_AXES); return 0; }
+    if (!(step > 0.0) || !(stop >= start)) {
+        fprintf(stderr, "Error: --sweep %s needs step > 0 and stop >= start.\n", name);
+        return 0;
+    }
+    const sweep_param *sp = &SWEEP_PARAMS[param];
+    if (start < sp->lo || (sp->lo_open && start <= sp->lo) || stop > sp->hi) {
+        fprintf(stderr, "Error: --sweep %s range %g:%g is outside the allowed values.\n", name, start, stop);
+        return 0;
+    }
+    double n = floor((stop - start) / step + 1e-6) + 1.0;
+    if (n > SWEEP_MAX_RUNS) { fprintf(stderr, "Error: --sweep %s has too many values.\n", name); return 0; }
+    sweep_axes[sweep_n_axes].param = param;
+    sweep_axes[sweep_n_axes].start = start;
+    sweep_axes[sweep_n_axes].step = step;
+    sweep_axes[sweep_n_axes].n = (int)n;
+    sweep_n_axes++;
+    return 1;
+}
+
+// Value of axis a in run `run` (the last axis varies fastest)
+static float sweep_value(int run, int a) {
+    for (int i = sweep_n_axes - 1; i > a; i--) run /= sweep_axes[i].n;
+    return (float)(sweep_axes[a].start + (run % sweep_axes[a].n) * sweep_axes[a].step);
+}
+
+// Run one combination on the current grids. `steps_arg` is --steps as given.
+static void sweep_run_one(int run, long steps_arg, float base_dt, sweep_result *res) {
+    G_DT = base_dt;
+    for (int a = 0; a < sweep_n_axes; a++) *SWEEP_PARAMS[sweep_axes[a].param].value = sweep_value(run, a);
+    G_BASE_DT = G_DT;
+    G_STEPS = steps_arg;
+    if (G_SIM_TIME > 0.0 && !G_ADAPTIVE) {
+        long sim_steps = (long)ceil(G_SIM_TIME / G_DT - 1e-6);
+        if (G_STEPS == 0 || sim_steps < G_STEPS) G_STEPS = sim_steps;
+    }
+    g_dt_min_used = g_dt_max_used = 0.0f;
+    initialize_simulation();
+
+    double t0 = now_seconds();
+    while (!run_finished()) advance_frame(G_ADAPTIVE ? 64.0 * G_TIME_BLOCK : G_TIME_BLOCK);
+    res->seconds = now_seconds() - t0;
+    res->run = run;
+    res->complete = !g_stop;
+    res->steps = g_step_count;
+    res->sim_time = g_sim_time;
+    res->energy = compute_energy(&res->max_h);
+}
+
+#ifndef _WIN32
+// Read exactly len bytes. A stop signal that interrupts the wait for a new record
+// ends the read (returns 0) so the caller can react to g_stop.
+static int sweep_read_all(int fd, void *buf, size_t len) {
+    char *p = (char *)buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            if (g_stop && p == (char *)buf) return 0;
+            continue;
+        }
+        if (n <= 0) return 0;
+        p += n; len -= (size_t)n;
+    }
+    return 1;
+}
+
+static int sweep_write_all(int fd, const void *buf, size_t len) {
+    const char *p = (const char *)buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        p += n; len -= (size_t)n;
+    }
+    return 1;
+}
+
+// Worker process: run whatever the coordinator sends on cmd_fd (-1 = done) and
+// answer each with a result record on result_fd (records are < PIPE_BUF, so the
+// workers' writes to the shared pipe never interleave)
+static void sweep_worker(int worker, int cmd_fd, int result_fd, long steps_arg, float base_dt) {
+    pool_start(G_THREADS < HEIGHT ? G_THREADS : HEIGHT);
+    allocate_grids();
+    int run;
+    while (!g_stop && sweep_read_all(cmd_fd, &run, sizeof(run)) && run >= 0) {
+        sweep_result res;
+        memset(&res, 0, sizeof(res));
+        res.worker = worker;
+        sweep_run_one(run, steps_arg, base_dt, &res);
+        if (!sweep_write_all(result_fd, &res, sizeof(res))) break;
+    }
+    pool_stop();
+    free_grids();
+}
+#endif
+
+// 1 if run `run` keeps the explicit step within its stability limit, speed_sq * dt^2
+// <= 0.5 as checked by main() for a single run (other integrators and adaptive dt
+// are stable for any --dt)
+static int sweep_run_stable(int run, float base_dt, float base_speed_sq) {
+    if (G_INTEGRATOR != INTEGRATOR_EXPLICIT || G_ADAPTIVE) return 1;
+    float dt = base_dt, speed_sq = base_speed_sq;
+    for (int a = 0; a < sweep_n_axes; a++) {
+        if (SWEEP_PARAMS[sweep_axes[a].param].value == &G_DT) dt = sweep_value(run, a);
+        if (SWEEP_PARAMS[sweep_axes[a].param].value == &G_WAVE_SPEED_SQ) speed_sq = sweep_value(run, a);
+    }
+    return speed_sq * dt * dt <= 0.5f;
+}
+
+// Run the whole sweep and write the CSV; returns the process exit code
+int run_sweep(long steps_arg, const char *csv_path) {
+    long long total = 1;
+    for (int a = 0; a < sweep_n_axes; a++) total *= sweep_axes[a].n;
+    if (total > SWEEP_MAX_RUNS) { fprintf(stderr, "Error: the sweep has %lld runs (at most %d).\n", total, SWEEP_MAX_RUNS); return 1; }
+    int runs = (int)total;
+    sweep_result *results = (sweep_result *)calloc((size_t)runs, sizeof(sweep_result));
+    char *done = (char *)calloc((size_t)runs, 1);
+    FILE *csv = fopen(csv_path, "w");
+    if (!results || !done || !csv) {
+        fprintf(stderr, "Error: could not start the sweep (%s): %s\n", csv_path, strerror(errno));
+        free(results); free(done);
+        if (csv) fclose(csv);
+        return 1;
+    }
+    float base_dt = G_DT, base_speed_sq = G_WAVE_SPEED_SQ;
+    double t0 = now_seconds();
+
+    int unstable = 0;
+    for (int run = 0; run < runs; run++) {
+        if (sweep_run_stable(run, base_dt, base_speed_sq)) continue;
+        if (unstable++ == 0) fprintf(stderr, "Warning: unstable combinations (speed_sq * dt^2 > 0.5):");
+        if (unstable <= 5) fprintf(stderr, " run %d", run);
+    }
+    if (unstable > 0) {
+        fprintf(stderr, "%s\n         (%d of %d runs; their CSV rows have stable = 0)\n",
+                unstable > 5 ? " ..." : "", unstable, runs);
+    }
+
+#ifndef _WIN32
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = (int)(cores > 0 ? cores : 1) / G_THREADS;
+    if (workers < 1) workers = 1;
+    if (workers > runs) workers = runs;
+    printf("Sweep: %d runs of %dx%d on %d worker processes x %d threads -> %s\n",
+           runs, WIDTH, HEIGHT, workers, G_THREADS, csv_path);
+    fflush(stdout); // Forked workers must not inherit buffered output
+
+    int result_pipe[2];
+    int *cmd_fd = (int *)malloc((size_t)workers * sizeof(int));
+    pid_t *pids = (pid_t *)malloc((size_t)workers * sizeof(pid_t));
+    if (!cmd_fd || !pids || pipe(result_pipe) != 0) {
+        fprintf(stderr, "Error: could not set up sweep workers: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    signal(SIGPIPE, SIG_IGN); // A worker that died is noticed by its missing results
+    // Stop signals must interrupt the blocking read of results (no SA_RESTART), so a
+    // signal sent to this process alone still reaches the workers (see below)
+    struct sigaction stop_action;
+    memset(&stop_action, 0, sizeof(stop_action));
+    stop_action.sa_handler = handle_stop_signal;
+    sigemptyset(&stop_action.sa_mask);
+    sigaction(SIGINT, &stop_action, NULL);
+    sigaction(SIGTERM, &stop_action, NULL);
+    for (int w = 0; w < workers; w++) {
+        int cmd[2];
+        if (pipe(cmd) != 0 || (pids[w] = fork()) < 0) {
+            fprintf(stderr, "Error: could not start sweep worker %d: %s\n", w, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        if (pids[w] == 0) {
+            close(cmd[1]);
+            close(result_pipe[0]);
+            for (int i = 0; i < w; i++) close(cmd_fd[i]);
+            fclose(csv);
+            sweep_worker(w, cmd[0], result_pipe[1], steps_arg, base_dt);
+            _exit(0);
+        }
+        close(cmd[0]);
+        cmd_fd[w] = cmd[1];
+    }
+    close(result_pipe[1]); // Reads see EOF once every worker has exited
+
+    int next = 0, finished = 0;
+    for (int w = 0; w < workers; w++) {
+        int run = next < runs ? next++ : -1;
+        sweep_write_all(cmd_fd[w], &run, sizeof(run));
+    }
+    sweep_result res;
+    int forwarded = 0;
+    for (;;) {
+        if (g_stop && !forwarded) {
+            // Cut the runs in progress short; their partial results still arrive
+            for (int w = 0; w < workers; w++) kill(pids[w], SIGTERM);
+            forwarded = 1;
+        }
+        if (!sweep_read_all(result_pipe[0], &res, sizeof(res))) {
+            if (g_stop && !forwarded) continue; // Interrupted by the stop signal
+            break;
+        }
+        if (res.run < 0 || res.run >= runs || res.worker < 0 || res.worker >= workers) continue;
+        results[res.run] = res;
+        done[res.run] = 1;
+        finished++;
+        int run = (next < runs && !g_stop) ? next++ : -1;
+        sweep_write_all(cmd_fd[res.worker], &run, sizeof(run));
+    }
+    close(result_pipe[0]);
+    for (int w = 0; w < workers; w++) {
+        close(cmd_fd[w]);
+        int status;
+        while (waitpid(pids[w], &status, 0) < 0 && errno == EINTR) {}
+    }
+    free(cmd_fd);
+    free(pids);
+#else // No fork(): run the combinations one after another in this process
+    printf("Sweep: %d runs of %dx%d -> %s\n", runs, WIDTH, HEIGHT, csv_path);
+    pool_start(G_THREADS < HEIGHT ? G_THREADS : HEIGHT);
+    allocate_grids();
+    int finished = 0;
+    for (int run = 0; run < runs && !g_stop; run++) {
+        sweep_run_one(run, steps_arg, base_dt, &results[run]);
+        done[run] = 1;
+        finished++;
+    }
+    pool_stop();
+    free_grids();
+#endif
+
+    fprintf(csv, "run");
+    for (int a = 0; a < sweep_n_axes; a++) fprintf(csv, ",%s", SWEEP_PARAMS[sweep_axes[a].param].name);
+    fprintf(csv, ",steps,sim_time,energy,max_height,steps_per_s,complete,stable\n");
+    for (int run = 0; run < runs; run++) {
+        if (!done[run]) continue;
+        const sweep_result *r = &results[run];
+        fprintf(csv, "%d", run);
+        for (int a = 0; a < sweep_n_axes; a++) fprintf(csv, ",%.6g", sweep_value(run, a));
+        fprintf(csv, ",%lld,%.6f,%.9g,%.6f,%.1f,%d,%d\n", (long long)r->steps, r->sim_time, r->energy, r->max_h,
+                r->seconds > 0.0 ? (double)r->steps / r->seconds : 0.0, r->complete,
+                sweep_run_stable(run, base_dt, base_speed_sq));
+    }
+    int ok = fclose(csv) == 0;
+    printf("Sweep: %d of %d runs in %.3f s%s\n", finished, runs, now_seconds() - t0,
+           finished < runs ? " (interrupted or a worker failed)" : "");
+    if (!ok) fprintf(stderr, "Error: could not write '%s'.\n", csv_path);
+    free(results);
+    free(done);
+    return ok && finished == runs ? 0 : 1;
+}
+
+// --- Differential Renderer ---
+// The characters on screen are remembered between frames. When only a few cells
+// changed, just those runs are sent, each preceded by a cursor-position escape;
+// when more than G_REDRAW_THRESHOLD of the screen changed (or on the first frame),
+// the whole screen is redrawn.
+#define RENDER_RUN_GAP 6 // Unchanged cells cheaper to resend than a new cursor escape
+#define RENDER_CLEAR "\033[H\033[J" // Home and clear, as CLEAR_SCREEN() sends
+#define RENDER_CLEAR_LEN 6
+
+static struct {
+    char *prev;               // Characters drawn by the previous frame (VIEW_W * VIEW_H)
+    char *cur;                // Characters of the frame being drawn
+    char *out;                // Escape/character stream of a differential frame
+    size_t out_cap;
+    int valid;                // prev matches what is on screen
+    long frames;              // Frames drawn
+    long full_frames;         // ...of which full redraws
+    unsigned long long bytes; // Bytes written by all frames
+    size_t last_bytes;        // Bytes written by the last frame
+} render;
+
+void free_view_pool(void);
+
+void free_renderer(void) {
+    free(render.prev); free(render.cur); free(render.out);
+    memset(&render, 0, sizeof(render));
+    free_view_pool();
+}
+
+// Make the next frame a full redraw, whatever changed
+void renderer_invalidate(void) { render.valid = 0; }
+
+// Lazily allocate the renderer buffers; returns 0 if they are unavailable
+static int renderer_ready(void) {
+    if (render.cur) return 1;
+    size_t cells = (size_t)VIEW_W * VIEW_H;
+    render.prev = (char *)malloc(cells);
+    render.cur = (char *)malloc(cells);
+    // A full frame (clear/home escapes and every row) plus the --stats line
+    render.out_cap = RENDER_CLEAR_LEN + (size_t)(VIEW_W + 1) * VIEW_H + 128;
+    render.out = (char *)malloc(render.out_cap);
+    if (!render.prev || !render.cur || !render.out) {
+        free_renderer();
+        return 0;
+    }
+    return 1;
+}
+
+// Append the changed runs of every row to render.out. Returns the stream length, or 0
+// if it would not be smaller than a full redraw.
+static size_t build_diff_frame(size_t full_len) {
+    size_t len = 0;
+    for (int r = 0; r < VIEW_H; r++) {
+        const char *cur = render.cur + (size_t)r * VIEW_W;
+        const char *prev = render.prev + (size_t)r * VIEW_W;
+        if (memcmp(cur, prev, VIEW_W) == 0) continue;
+        int c = 0;
+        while (c < VIEW_W) {
+            if (cur[c] == prev[c]) { c++; continue; }
+            // Extend the run across short stretches of unchanged cells
+            int start = c, end = c + 1, gap = 0;
+            for (int i = end; i < VIEW_W && gap <= RENDER_RUN_GAP; i++) {
+                if (cur[i] != prev[i]) { end = i + 1; gap = 0; } else gap++;
+            }
+            if (len + (size_t)(end - start) + 24 > full_len) return 0;
+            len += (size_t)snprintf(render.out + len, render.out_cap - len, "\033[%d;%dH", r + 1, start + 1);
+            memcpy(render.out + len, cur + start, (size_t)(end - start));
+            len += (size_t)(end - start);
+            c = end;
+        }
+    }
+    // Leave the cursor below the grid, where a full redraw leaves it
+    len += (size_t)snprintf(render.out + len, render.out_cap - len, "\033[%d;1H", VIEW_H + 1);
+    return len;
+}
+
+// Build the whole screen (clear + every row) in render.out; returns its length
+static size_t build_full_frame(const char *chars) {
+    char *p = render.out;
+#ifndef _WIN32 // The Windows console is cleared with "cls" instead, see frame_write()
+    memcpy(p, RENDER_CLEAR, RENDER_CLEAR_LEN);
+    p += RENDER_CLEAR_LEN;
+#endif
+    for (int r = 0; r < VIEW_H; r++) {
+        memcpy(p, chars + (size_t)r * VIEW_W, VIEW_W);
+        p += VIEW_W;
+        *p++ = '\n'; // Newline after each row
+    }
+    return (size_t)(p - render.out);
+}
+
+// Send a frame to the terminal in one write(), retrying partial writes and EINTR
+static void frame_write(const char *buf, size_t len, int full) {
+    fflush(stdout); // Anything printed through stdio must go first
+#ifdef _WIN32
+    if (full) CLEAR_SCREEN();
+    fwrite(buf, 1, len, stdout);
+    fflush(stdout);
+#else
+    (void)full;
+    while (len > 0) {
+        ssize_t n = write(STDOUT_FILENO, buf, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return; // Terminal gone: drop the frame
+        buf += n;
+        len -= (size_t)n;
+    }
+#endif
+}
+
+// --- Downsampling Renderer ---
+// A grid larger than the screen is reduced to VIEW_W x VIEW_H cells before
+// height_to_char(): each screen cell shows the max (--pool max) or mean (--pool mean)
+// height of the water in its block of grid cells, or 'X' when most of the block is
+// wall. Walls hold h = 0 and h is never negative, so whole rows can be folded into a
+// column accumulator without tests; the wall share comes from popcounts of the
+// obstacle bits. Screen rows are split across the worker pool.
+enum { POOL_MAX, POOL_MEAN };
+static const char *const POOL_NAMES[] = { "max", "mean" };
+
+typedef void (*fold_row_fn)(float *acc, const float *row, int n);
+
+static void fold_max_scalar(float *acc, const float *row, int n) {
+    for (int i = 0; i < n; i++) acc[i] = acc[i] > row[i] ? acc[i] : row[i];
+}
+
+static void fold_sum_scalar(float *acc, const float *row, int n) {
+    for (int i = 0; i < n; i++) acc[i] += row[i];
+}
+
+#ifdef CFD_X86_SIMD
+__attribute__((target("avx2")))
+static void fold_max_avx2(float *acc, const float *row, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) _mm256_storeu_ps(acc + i, _mm256_max_ps(_mm256_loadu_ps(acc + i), _mm256_loadu_ps(row + i)));
+    fold_max_scalar(acc + i, row + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void fold_sum_avx2(float *acc, const float *row, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) _mm256_storeu_ps(acc + i, _mm256_add_ps(_mm256_loadu_ps(acc + i), _mm256_loadu_ps(row + i)));
+    fold_sum_scalar(acc + i, row + i, n - i);
+}
+#endif // CFD_X86_SIMD
+
+static fold_row_fn fold_max = fold_max_scalar;
+static fold_row_fn fold_sum = fold_sum_scalar;
+
+// Use the AVX2 row folds unless the scalar kernel was asked for
+void select_view_fold(int kernel) {
+#ifdef CFD_X86_SIMD
+    if (kernel != KERNEL_SCALAR && __builtin_cpu_supports("avx2")) {
+        fold_max = fold_max_avx2;
+        fold_sum = fold_sum_avx2;
+    }
+#else
+    (void)kernel;
+#endif
+}
+
+#define VIEW_SLOT 8 // size_t per worker in view_changed (one cache line)
+
+static float *view_acc = NULL;      // Per-worker column accumulators
+static size_t view_acc_stride = 0;
+static size_t *view_changed = NULL; // Per-worker count of screen cells that changed
+static int *view_col = NULL;        // Screen column c covers grid columns [view_col[c], view_col[c+1])
+static int view_workers = 0;
+
+void free_view_pool(void) {
+    aligned_block_free(view_acc);
+    aligned_block_free(view_changed);
+    free(view_col);
+    view_acc = NULL; view_changed = NULL; view_col = NULL;
+    view_workers = 0;
+}
+
+static int view_pool_ready(int n_workers) {
+    if (view_workers >= n_workers) return 1;
+    free_view_pool();
+    view_acc_stride = grid_stride(WIDTH, sizeof(float));
+    view_acc = (float *)aligned_block_alloc((size_t)n_workers * view_acc_stride * sizeof(float));
+    view_changed = (size_t *)aligned_block_alloc((size_t)n_workers * VIEW_SLOT * sizeof(size_t));
+    view_col = (int *)malloc((size_t)(VIEW_W + 1) * sizeof(int));
+    if (!view_acc || !view_changed || !view_col) {
+        free_view_pool();
+        return 0;
+    }
+    for (int c = 0; c <= VIEW_W; c++) view_col[c] = (int)((long long)c * WIDTH / VIEW_W);
+    view_workers = n_workers;
+    return 1;
+}
+
+// Number of set bits of a bit row in columns [c0, c1)
+static int bits_count_range(const uint64_t *row, int c0, int c1) {
+    int w0 = c0 >> 6, w1 = (c1 - 1) >> 6, n = 0;
+    for (int w = w0; w <= w1; w++) {
+        uint64_t m = row[w];
+        if (w == w0) m &= ~(uint64_t)0 << (c0 & 63);
+        if (w == w1) m &= ~(uint64_t)0 >> (63 - ((c1 - 1) & 63));
+        n += __builtin_popcountll(m);
+    }
+    return n;
+}
+
+// Pool job: reduce a band of screen rows into render.cur
+static void view_pool_job(void *arg, int worker, int n_workers) {
+    const grid_f *heights = (const grid_f *)arg;
+    float *acc = view_acc + (size_t)worker * view_acc_stride;
+    fold_row_fn fold = G_POOL == POOL_MEAN ? fold_sum : fold_max;
+    size_t changed = 0;
+    int v0, v1;
+    pool_band(VIEW_H, worker, n_workers, &v0, &v1);
+    for (int vr = v0; vr < v1; vr++) {
+        int r0 = (int)((long long)vr * HEIGHT / VIEW_H), r1 = (int)((long long)(vr + 1) * HEIGHT / VIEW_H);
+        memcpy(acc, GRID_ROW(*heights, r0), (size_t)WIDTH * sizeof(float));
+        for (int r = r0 + 1; r < r1; r++) fold(acc, GRID_ROW(*heights, r), WIDTH);
+
+        char *out = render.cur + (size_t)vr * VIEW_W;
+        const char *prev = render.prev + (size_t)vr * VIEW_W;
+        for (int vc = 0; vc < VIEW_W; vc++) {
+            int c0 = view_col[vc], c1 = view_col[vc + 1];
+            int cells = (r1 - r0) * (c1 - c0), walls = 0;
+            for (int r = r0; r < r1; r++) walls += bits_count_range(BITS_ROW(obstacle, r), c0, c1);
+            if (2 * walls > cells) {
+                out[vc] = 'X';
+            } else if (G_POOL == POOL_MEAN) {
+                float sum = 0.0f;
+                for (int c = c0; c < c1; c++) sum += acc[c];
+                out[vc] = height_to_char(sum / (float)(cells - walls));
+            } else {
+                float m = acc[c0];
+                for (int c = c0 + 1; c < c1; c++) m = m > acc[c] ? m : acc[c];
+                out[vc] = height_to_char(m);
+            }
+            changed += out[vc] != prev[vc];
+        }
+    }
+    view_changed[(size_t)worker * VIEW_SLOT] = changed;
+}
+
+// Fill render.cur with the pooled screen; returns the number of changed cells.
+// With --async-render the pool belongs to the simulation thread, so the reduction
+// runs on the calling thread alone.
+static size_t pool_view(const grid_f *heights) {
+    int n_workers = G_ASYNC_RENDER ? 1 : pool_size();
+    if (!view_pool_ready(n_workers)) {
+        fprintf(stderr, "Error: Memory allocation failed for the downsampling renderer.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (n_workers == 1) view_pool_job((void *)heights, 0, 1);
+    else pool_run(view_pool_job, (void *)heights);
+    size_t changed = 0;
+    for (int i = 0; i < n_workers; i++) changed += view_changed[(size_t)i * VIEW_SLOT];
+    return changed;
+}
+
+// Draw a height field (same shape as h) with the current obstacle layout
+void display_heights(const grid_f *heights) {
+    const int pooled = VIEW_W != WIDTH || VIEW_H != HEIGHT;
+    if (!renderer_ready() && !pooled) { // No memory for frame history: draw straight from the grid
+        for (int r = 0; r < HEIGHT; r++) {
+            for (int c = 0; c < WIDTH; c++) {
+                if (!r && !c) CLEAR_SCREEN();
+                printf("%c", BITS_AT(obstacle, r, c) ? 'X' : height_to_char(GRID_AT(*heights, r, c)));
+            }
+            printf("\n");
+        }
+        fflush(stdout);
+        return;
+    }
+
+    if (!render.cur) {
+        fprintf(stderr, "Error: Memory allocation failed for the renderer.\n");
+        exit(EXIT_FAILURE);
+    }
+    STATS_BEGIN(t_quantize);
+    size_t changed = 0;
+    if (pooled) changed = pool_view(heights);
+    for (int r = 0; !pooled && r < HEIGHT; r++) {
+        char *row = render.cur + (size_t)r * WIDTH;
+        const char *prev = render.prev + (size_t)r * WIDTH;
+        changed += quantize_row(row, prev, GRID_ROW(*heights, r), BITS_ROW(obstacle, r), WIDTH);
+    }
+
+    size_t full_len = RENDER_CLEAR_LEN + (size_t)(VIEW_W + 1) * VIEW_H;
+    enum { FRAME_FULL, FRAME_DIFF, FRAME_NONE } kind = FRAME_FULL;
+#ifndef _WIN32 // The Windows console path clears with "cls" and does not rely on ANSI cursor moves
+    if (render.valid && (double)changed <= (double)G_REDRAW_THRESHOLD * VIEW_W * VIEW_H) {
+        kind = changed ? FRAME_DIFF : FRAME_NONE; // Nothing moved: nothing to send
+    }
+#endif
+    size_t len = 0;
+    if (kind == FRAME_DIFF) {
+        len = build_diff_frame(full_len); // Into render.out
+        if (len == 0) kind = FRAME_FULL;  // Longer than a full redraw
+    }
+    if (kind == FRAME_FULL) {
+        len = build_full_frame(render.cur);
+        render.full_frames++;
+    }
+    render.last_bytes = len;
+    render.frames++;
+    render.bytes += render.last_bytes;
+
+    if (G_STATS) { // Same write as the frame
+        len += (size_t)snprintf(render.out + len, render.out_cap - len, "\r\033[Kframe %ld: %zu bytes (%s), avg %.0f bytes/frame",
+                                render.frames, render.last_bytes,
+                                kind == FRAME_FULL ? "full" : (kind == FRAME_DIFF ? "diff" : "none"),
+                                (double)render.bytes / render.frames);
+    }
+    STATS_END(PHASE_QUANTIZE, t_quantize);
+    STATS_BEGIN(t_output);
+    if (len > 0) frame_write(render.out, len, kind == FRAME_FULL);
+    STATS_END(PHASE_OUTPUT, t_output);
+
+    char *tmp = render.prev;
+    render.prev = render.cur;
+    render.cur = tmp;
+    render.valid = 1;
+}
+
+void display_grid() {
+    if (G_STORAGE != STORAGE_FP32) {
+        if (!storage_view.data && !grid_f_alloc(&storage_view, WIDTH, HEIGHT)) {
+            fprintf(stderr, "Error: Memory allocation failed for display buffer.\n");
+            exit(EXIT_FAILURE);
+        }
+        storage_widen_heights(&storage_view);
+        display_heights(&storage_view);
+        return;
+    }
+    display_heights(&h);
+}
+
+// Summary of the renderer's output volume (--stats)
+void report_render_stats(void) {
+    if (render.frames == 0) return;
+    printf("Render: %ld frames (%ld full redraws), %llu bytes, %.0f bytes/frame\n",
+           render.frames, render.full_frames, render.bytes, (double)render.bytes / render.frames);
+}
+
+// --- Frame Pacing ---
+// Frames are scheduled on absolute deadlines (start + n * period), so the time spent
+// stepping and drawing does not stretch the period. Each frame advances as many
+// steps as the simulated-time rate calls for; if the work overruns the deadline the
+// frame's render is dropped so the simulation keeps its rate.
+#define PACE_MAX_LAG_S 1.0 // Behind by more than this: give up catching up and re-anchor
+
+typedef struct {
+    double period;        // Seconds per frame (0 = unpaced)
+    double next;          // Absolute deadline of the current frame
+    double steps_per_frame;
+    double step_debt;     // Fractional steps carried to the next frame
+    long frames;
+    long missed;          // Frames whose work ended after their deadline
+    long dropped;         // Renders skipped to keep up
+    int timed;            // Record waits as PHASE_SLEEP (one pacer per run, see Phase Timing)
+} frame_pacer;
+
+// Without a simulated-time rate every frame advances `default_steps`
+static void pacer_init(frame_pacer *p, double fps, double sim_rate, float dt, int default_steps) {
+    memset(p, 0, sizeof(*p));
+    p->period = fps > 0.0 ? 1.0 / fps : 0.0;
+    p->steps_per_frame = (sim_rate > 0.0 && fps > 0.0) ? sim_rate / fps / dt : default_steps;
+    p->next = now_seconds() + p->period;
+    p->timed = 1;
+}
+
+// Steps to run this frame (the fractional remainder carries over)
+static long pacer_steps(frame_pacer *p) {
+    p->step_debt += p->steps_per_frame;
+    long n = (long)p->step_debt;
+    p->step_debt -= (double)n;
+    return n;
+}
+
+// Call when the frame's work is done: returns 1 if it still met its deadline
+static int pacer_on_time(frame_pacer *p) {
+    p->frames++;
+    if (p->period <= 0.0 || now_seconds() <= p->next) return 1;
+    p->missed++;
+    return 0;
+}
+
+// Sleep until the current deadline and move on to the next frame
+static void pacer_wait(frame_pacer *p) {
+    if (p->period <= 0.0) return;
+    STATS_BEGIN(t0);
+    sleep_until(p->next);
+    if (p->timed) STATS_END(PHASE_SLEEP, t0);
+    p->next += p->period;
+    double now = now_seconds();
+    if (now - p->next > PACE_MAX_LAG_S) p->next = now + p->period;
+}
+
+static double pacer_fps(void) {
+    if (G_FPS > 0.0f) return G_FPS;
+    return G_SLEEP_MS > 0 ? 1000.0 / G_SLEEP_MS : 0.0;
+}
+
+// --- Async Rendering ---
+// With --async-render the simulation runs on its own thread and publishes a copy of h
+// after every step (or time block) into a triple buffer. The main thread draws the
+// newest published snapshot at its own pace. Publishing and taking a snapshot are a
+// single atomic exchange each, so neither side ever waits for the other.
+#ifdef CFD_THREADS
+#define SNAP_FRESH 4 // Set in snap.middle when it holds a snapshot not yet taken
+
+static struct {
+    grid_f slots[3];
+    atomic_int middle;       // Slot index shared between the two sides (| SNAP_FRESH)
+    int back;                // Slot the simulation writes next (simulation-owned)
+    int front;               // Slot being drawn (render-owned)
+    atomic_int done;         // Simulation thread has finished
+} snap;
+
+static void snapshot_publish(void) {
+    grid_f *dst = &snap.slots[snap.back];
+    if (G_STORAGE != STORAGE_FP32) storage_widen_heights(dst);
+    else memcpy(dst->data, h.data, h.stride * (size_t)HEIGHT * sizeof(float));
+    snap.back = atomic_exchange_explicit(&snap.middle, snap.back | SNAP_FRESH, memory_order_acq_rel) & 3;
+}
+
+// Take the newest snapshot if one was published since the last call
+static const grid_f *snapshot_acquire(void) {
+    if (!(atomic_load_explicit(&snap.middle, memory_order_acquire) & SNAP_FRESH)) return NULL;
+    snap.front = atomic_exchange_explicit(&snap.middle, snap.front, memory_order_acq_rel) & 3;
+    return &snap.slots[snap.front];
+}
+
+static frame_pacer sim_pacer; // Ticks of the simulation thread (same period as frames)
+
+static void *simulation_thread(void *arg) {
+    (void)arg;
+    pacer_init(&sim_pacer, pacer_fps(), G_SIM_RATE, G_BASE_DT, G_TIME_BLOCK);
+    sim_pacer.timed = 0; // Sleep is timed on the render side
+    checkpoint_tick();
+    while (!run_finished()) {
+        advance_frame(G_ADAPTIVE ? sim_pacer.steps_per_frame : (double)pacer_steps(&sim_pacer));
+        checkpoint_tick();
+        snapshot_publish();
+        pacer_on_time(&sim_pacer);
+        pacer_wait(&sim_pacer);
+    }
+    atomic_store_explicit(&snap.done, 1, memory_order_release);
+    return NULL;
+}
+
+// Run simulation and rendering on separate threads until the run is finished
+void run_async_render(void) {
+    for (int i = 0; i < 3; i++) {
+        if (!grid_f_alloc(&snap.slots[i], WIDTH, HEIGHT)) {
+            fprintf(stderr, "Error: Memory allocation failed for render snapshots.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    snap.back = 0;
+    atomic_store(&snap.middle, 1);
+    snap.front = 2;
+    atomic_store(&snap.done, 0);
+
+    pthread_t sim;
+    if (pthread_create(&sim, NULL, simulation_thread, NULL) != 0) {
+        fprintf(stderr, "Error: could not create simulation thread.\n");
+        exit(EXIT_FAILURE);
+    }
+    long frames_skipped = 0;
+    frame_pacer render_pacer;
+    pacer_init(&render_pacer, pacer_fps(), 0.0, G_DT, 0);
+    for (;;) {
+        int finished = atomic_load_explicit(&snap.done, memory_order_acquire);
+        const grid_f *frame = snapshot_acquire();
+        if (frame) display_heights(frame); else frames_skipped++;
+        stats_poll();
+        if (finished) break;
+        pacer_on_time(&render_pacer);
+        pacer_wait(&render_pacer);
+    }
+    pthread_join(sim, NULL);
+    for (int i = 0; i < 3; i++) grid_f_free(&snap.slots[i]);
+    printf("\nPacing: simulation missed %ld of %ld tick deadlines, renderer missed %ld of %ld\n",
+           sim_pacer.missed, sim_pacer.frames, render_pacer.missed, render_pacer.frames);
+    if (G_STATS) printf("Async render: %ld render ticks without a new snapshot\n", frames_skipped);
+}
+#endif // CFD_THREADS
+
+#ifndef CFD_NO_MAIN // bench.c includes this file and supplies its own main()
+
+int main(int argc, char *argv[]) {
+    int dt_given = 0, speed_sq_given = 0, damping_given = 0; // Physics flags that override a checkpoint
+    // Argument Parsing
+    for (int k = 1; k < argc; ++k) {
+        if (strcmp(argv[k], "--dt") == 0) {
+            if (++k < argc) { G_DT = atof(argv[k]); dt_given = 1; } else { print_usage(argv[0]); return 1; }
+        } else if (strcmp(argv[k], "--speed_sq") == 0) {
+            if (++k < argc) { G_WAVE_SPEED_SQ = atof(argv[k]); speed_sq_given = 1; } else { print_usage(argv[0]); return 1; }
+        } else if (strcmp(argv[k], "--damping") == 0) {
+            if (++k < argc) { G_DAMPING = atof(argv[k]); damping_given = 1; } else { print_usage(argv[0]); return 1; }
+        } else if (strcmp(argv[k], "--level") == 0) {
+            if (++k < argc) G_INITIAL_WATER_LEVEL = atof(argv[k]); else { print_usage(argv[0]); return 1; }
+        } else if (strcmp(argv[k], "--tilt") == 0) {
+            if (++k < argc) G_INITIAL_TILT = atof(argv[k]); else { print_usage(argv[0]); return 1; }
+        } else if (strcmp(argv[k], "--sleep") == 0) {
+            if (++k < argc) G_SLEEP_MS = atoi(argv[k]); else { print_usage(argv[0]); return 1; }
+        } else if (strcmp(argv[k], "--fps") == 0) {
+            if (++k < argc) G_FPS = atof(argv[k]); else { print_usage(argv[0]); return 1; }
+        } else if (strcmp(argv[k], "--sim-rate") == 0) {
+            if (++k < argc) G_SIM_RATE = atof(argv[k]); else { print_usage(argv[0]); return 1; }
+        } else if (strcmp(argv[k], "--adaptive") == 0) {
+            G_ADAPTIVE = 1;
+        } else if (strcmp(argv[k], "--adapt-dh") == 0) {
+            if (++k < argc) G_ADAPT_DH = atof(argv[k]); else { print_usage(argv[0]); return 1; }
+        } else if (strcmp(argv[k], "--sim-time") == 0) {
+            if (++k < argc) G_SIM_TIME = atof(argv[k]); else { print_usage(argv[0]); return 1; }
+        } else if (strcmp(argv[k], "--threads") == 0) {
+            if (++k < argc) G_THREADS = atoi(argv[k]); else { print_usage(argv[0]); return 1; }
+        } else if (strcmp(argv[k], "--time-block") == 0) {
+            if (++k < argc) G_TIME_BLOCK = atoi(argv[k]); else { print_usage(argv[0]); return 1; }
+        } else if (strcmp(argv[k], "--headless") == 0) {
+            G_HEADLESS = 1;
+        } else if (strcmp(argv[k], "--steps") == 0) {
+            if (++k < argc) G_STEPS = atol(argv[k]); else { print_usage(argv[0]); return 1; }
+        } else if (strcmp(argv[k], "--grid") == 0) {
+            if (++k >= argc || sscanf(argv[k], "%dx%d", &G_GRID_W, &G_GRID_H) != 2) { print_usage(argv[0]); return 1; }
+        } else if (strcmp(argv[k], "--redraw-threshold") == 0) {
+            if (++k < argc) G_REDRAW_THRESHOLD = atof(argv[k]); else { print_usage(argv[0]); return 1; }
+        } else if (strcmp(argv[k], "--async-render") == 0) {
+            G_ASYNC_RENDER = 1;
+        } else if (strcmp(argv[k], "--stats") == 0) {
+            G_STATS = 1;
+        } else if (strcmp(argv[k], "--perf-counters") == 0) {
+            G_PERF_COUNTERS = 1;
+        } else if (strcmp(argv[k], "--active-tiles") == 0) {
+            G_ACTIVE_TILES = 1;
+        } else if (strcmp(argv[k], "--quiescence") == 0) {
+            if (++k < argc) G_QUIESCENCE = atof(argv[k]); else { print_usage(argv[0]); return 1; }
+        } else if (strcmp(argv[k], "--pool") == 0) {
+            if (++k >= argc) { print_usage(argv[0]); return 1; }
+            G_POOL = -1;
+            for (int i = 0; i < (int)(sizeof(POOL_NAMES) / sizeof(POOL_NAMES[0])); i++) {
+                if (strcmp(argv[k], POOL_NAMES[i]) == 0) G_POOL = i;
+            }
+            if (G_POOL < 0) { fprintf(stderr, "Error: unknown pool mode '%s'.\n", argv[k]); return 1; }
+        } else if (strcmp(argv[k], "--checkpoint-every") == 0) {
+            if (++k < argc) G_CHECKPOINT_EVERY = atol(argv[k]); else { print_usage(argv[0]); return 1; }
+        } else if (strcmp(argv[k], "--checkpoint-file") == 0) {
+            if (++k < argc) G_CHECKPOINT_FILE = argv[k]; else { print_usage(argv[0]); return 1; }
+        } else if (strcmp(argv[k], "--sweep") == 0) {
+            if (++k >= argc) { print_usage(argv[0]); return 1; }
+            if (!sweep_add_axis(argv[k])) return 1;
+        } else if (strcmp(argv[k], "--sweep-out") == 0) {
+            if (++k < argc) G_SWEEP_OUT = argv[k]; else { print_usage(argv[0]); return 1; }
+        } else if (strcmp(argv[k], "--map") == 0) {
+            if (++k < argc) G_MAP = argv[k]; else { print_usage(argv[0]); return 1; }
+        } else if (strcmp(argv[k], "--restore") == 0) {
+            if (++k < argc) G_RESTORE = argv[k]; else { print_usage(argv[0]); return 1; }
+        } else if (strcmp(argv[k], "--storage") == 0) {
+            if (++k >= argc) { print_usage(argv[0]); return 1; }
+            G_STORAGE = -1;
+            for (int i = 0; i < N_STORAGE; i++) {
+                if (strcmp(argv[k], STORAGE_CODECS[i].name) == 0) G_STORAGE = i;
+            }
+            if (G_STORAGE < 0) { fprintf(stderr, "Error: unknown storage format '%s'.\n", argv[k]); return 1; }
+        } else if (strcmp(argv[k], "--integrator") == 0) {
+            if (++k >= argc) { print_usage(argv[0]); return 1; }
+            G_INTEGRATOR = -1;
+            for (int i = 0; i < (int)(sizeof(INTEGRATOR_NAMES) / sizeof(INTEGRATOR_NAMES[0])); i++) {
+                if (strcmp(argv[k], INTEGRATOR_NAMES[i]) == 0) G_INTEGRATOR = i;
+            }
+            if (G_INTEGRATOR < 0) { fprintf(stderr, "Error: unknown integrator '%s'.\n", argv[k]); return 1; }
+        } else if (strcmp(argv[k], "--cg-tol") == 0) {
+            if (++k < argc) G_CG_TOL = atof(argv[k]); else { print_usage(argv[0]); return 1; }
+        } else if (strcmp(argv[k], "--procs") == 0) {
+            if (++k < argc) G_PROCS = atoi(argv[k]); else { print_usage(argv[0]); return 1; }
+        } else if (strcmp(argv[k], "--kernel") == 0) {
+            if (++k >= argc) { print_usage(argv[0]); return 1; }
+            G_KERNEL = -1;
+            for (int i = 0; i < (int)(sizeof(KERNEL_NAMES) / sizeof(KERNEL_NAMES[0])); i++) {
+                if (strcmp(argv[k], KERNEL_NAMES[i]) == 0) G_KERNEL = i;
+            }
+            if (G_KERNEL < 0) { fprintf(stderr, "Error: unknown kernel '%s'.\n", argv[k]); return 1; }
+        } else if (strcmp(argv[k], "-h") == 0 || strcmp(argv[k], "--help") == 0) {
+            print_usage(argv[0]); return 0;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[k]);
+            print_usage(argv[0]); return 1;
+        }
+    }
+
+    // A checkpoint brings its own grid, storage format and physics; load it before
+    // validating so the checks below see the restored values. --dt, --speed_sq and
+    // --damping given alongside it override the checkpoint's physics
+    if (G_RESTORE) {
+        int storage = G_STORAGE;
+        float dt = G_DT, speed_sq = G_WAVE_SPEED_SQ, damping = G_DAMPING;
+        if (G_GRID_W) { fprintf(stderr, "Error: --grid cannot be combined with --restore (the checkpoint sets the grid).\n"); return 1; }
+        if (G_MAP) { fprintf(stderr, "Error: --map cannot be combined with --restore (the checkpoint has its own obstacles).\n"); return 1; }
+        if (!checkpoint_restore(G_RESTORE)) return 1;
+        if (storage != STORAGE_FP32 && storage != G_STORAGE) {
+            fprintf(stderr, "Error: checkpoint uses %s storage, not %s.\n", STORAGE_CODECS[G_STORAGE].name, STORAGE_CODECS[storage].name);
+            return 1;
+        }
+        if (dt_given) G_DT = G_BASE_DT = dt;
+        if (speed_sq_given) G_WAVE_SPEED_SQ = speed_sq;
+        if (damping_given) G_DAMPING = damping;
+    }
+
+    // Validate parsed parameters
+    if (G_DT <= 0) { fprintf(stderr, "Error: dt must be > 0.\n"); return 1; }
+    if (G_WAVE_SPEED_SQ <= 0) { fprintf(stderr, "Error: speed_sq must be > 0.\n"); return 1; }
+    // G_DAMPING * G_DT should ideally be < 1 for stable damping. Here G_DAMPING is the factor.
+    if (G_DAMPING < 0.0f ) { fprintf(stderr, "Error: damping must be >= 0.0.\n"); return 1; }
+    if (G_INITIAL_WATER_LEVEL < 0.0f || G_INITIAL_WATER_LEVEL > 1.0f) { fprintf(stderr, "Error: level must be 0.0-1.0.\n"); return 1; }
+    if (G_INITIAL_TILT < 0.0f || G_INITIAL_TILT > 1.0f) { fprintf(stderr, "Error: tilt must be 0.0-1.0.\n"); return 1; }
+    if (G_SLEEP_MS < 0) { fprintf(stderr, "Error: sleep ms must be >= 0.\n"); return 1; }
+    if (G_FPS < 0.0f) { fprintf(stderr, "Error: fps must be >= 0.\n"); return 1; }
+    if (G_SIM_RATE < 0.0f) { fprintf(stderr, "Error: sim-rate must be >= 0.\n"); return 1; }
+    if (G_ADAPT_DH <= 0.0f) { fprintf(stderr, "Error: adapt-dh must be > 0.\n"); return 1; }
+    if (G_SIM_TIME < 0.0) { fprintf(stderr, "Error: sim-time must be >= 0.\n"); return 1; }
+    if (G_THREADS < 1) { fprintf(stderr, "Error: threads must be >= 1.\n"); return 1; }
+    if (G_REDRAW_THRESHOLD < 0.0f || G_REDRAW_THRESHOLD > 1.0f) { fprintf(stderr, "Error: redraw-threshold must be 0.0-1.0.\n"); return 1; }
+#ifndef CFD_THREADS
+    if (G_ASYNC_RENDER) { fprintf(stderr, "Error: --async-render requires POSIX threads.\n"); return 1; }
+#endif
+    if (G_ASYNC_RENDER && G_HEADLESS) { fprintf(stderr, "Error: --async-render and --headless are mutually exclusive.\n"); return 1; }
+    if (G_STEPS < 0) { fprintf(stderr, "Error: steps must be >= 0.\n"); return 1; }
+    if (G_GRID_W || G_GRID_H) {
+        if (G_GRID_W < 3 || G_GRID_H < 3) { fprintf(stderr, "Error: grid must be at least 3x3.\n"); return 1; }
+    }
+    if (G_TIME_BLOCK < 1 || G_TIME_BLOCK > TB_MAX_K) { fprintf(stderr, "Error: time-block must be 1-%d.\n", TB_MAX_K); return 1; }
+    if (G_CHECKPOINT_EVERY < 0) { fprintf(stderr, "Error: checkpoint-every must be >= 0.\n"); return 1; }
+    if (G_QUIESCENCE < 0.0f) { fprintf(stderr, "Error: quiescence must be >= 0.\n"); return 1; }
+    if (G_ACTIVE_TILES && G_TIME_BLOCK > 1) { fprintf(stderr, "Error: --active-tiles and --time-block are mutually exclusive.\n"); return 1; }
+    if (sweep_n_axes > 0) {
+        if (!G_HEADLESS) { fprintf(stderr, "Error: --sweep requires --headless.\n"); return 1; }
+        if (G_STEPS == 0 && G_SIM_TIME == 0.0) { fprintf(stderr, "Error: --sweep needs --steps or --sim-time.\n"); return 1; }
+        if (G_RESTORE || G_CHECKPOINT_EVERY) { fprintf(stderr, "Error: --sweep cannot be combined with checkpoints.\n"); return 1; }
+    }
+    if (G_STORAGE != STORAGE_FP32 && (G_TIME_BLOCK > 1 || G_ACTIVE_TILES)) {
+        fprintf(stderr, "Error: --storage %s cannot be combined with --time-block or --active-tiles.\n", STORAGE_CODECS[G_STORAGE].name);
+        return 1;
+    }
+    if (G_CG_TOL <= 0.0f || G_CG_TOL >= 1.0f) { fprintf(stderr, "Error: cg-tol must be between 0 and 1.\n"); return 1; }
+    if (G_INTEGRATOR == INTEGRATOR_IMPLICIT &&
+        (G_TIME_BLOCK > 1 || G_ACTIVE_TILES || G_ADAPTIVE || G_STORAGE != STORAGE_FP32)) {
+        fprintf(stderr, "Error: --integrator implicit cannot be combined with --time-block, --active-tiles, --adaptive or --storage.\n");
+        return 1;
+    }
+    if (G_INTEGRATOR == INTEGRATOR_SPECTRAL &&
+        (G_TIME_BLOCK > 1 || G_ACTIVE_TILES || G_ADAPTIVE || G_STORAGE != STORAGE_FP32)) {
+        fprintf(stderr, "Error: --integrator spectral cannot be combined with --time-block, --active-tiles, --adaptive or --storage.\n");
+        return 1;
+    }
+    if (G_PROCS < 1) { fprintf(stderr, "Error: procs must be >= 1.\n"); return 1; }
+#ifdef _WIN32
+    if (G_PROCS > 1) { fprintf(stderr, "Error: --procs needs fork(), which this platform lacks.\n"); return 1; }
+#endif
+    if (G_PROCS > 1 && (G_THREADS > 1 || G_TIME_BLOCK > 1 || G_ACTIVE_TILES || G_ADAPTIVE || G_STORAGE != STORAGE_FP32 ||
+                        G_INTEGRATOR != INTEGRATOR_EXPLICIT || sweep_n_axes > 0 || G_PERF_COUNTERS)) {
+        fprintf(stderr, "Error: --procs steps each slab on one thread with the explicit fp32 step; it cannot be combined with\n"
+                        "       --threads, --time-block, --active-tiles, --adaptive, --storage, --integrator implicit/spectral, --sweep\n"
+                        "       or --perf-counters.\n");
+        return 1;
+    }
+
+    // Check a common stability condition for this explicit finite difference scheme (Courant-Friedrichs-Lewy like)
+    // For a 2D wave equation with 5-point Laplacian, (c*DT/dx)^2 <= 0.5 often applies.
+    // Here, c^2 is G_WAVE_SPEED_SQ, and dx (cell spacing) is implicitly 1.
+    float stability_metric = G_WAVE_SPEED_SQ * G_DT * G_DT;
+    long steps_arg = G_STEPS; // --steps as given (a sweep converts --sim-time per run)
+    if (!G_RESTORE) G_BASE_DT = G_DT; // A checkpoint carries the run's own --dt
+    if (G_ADAPTIVE) stability_metric = 0.0f; // The controller keeps dt below the limit
+    if (G_INTEGRATOR != INTEGRATOR_EXPLICIT) stability_metric = 0.0f; // Stable for any dt
+    if (G_SIM_TIME > 0.0 && !G_ADAPTIVE) {
+        // Fixed dt: the simulated-time target is just a step count. A restored run counts
+        // from where the checkpoint left off, since its dt may have been overridden
+        double remaining = G_SIM_TIME - g_sim_time;
+        long sim_steps = g_step_count + (remaining > 0.0 ? (long)ceil(remaining / G_DT - 1e-6) : 0);
+        if (G_STEPS == 0 || sim_steps < G_STEPS) G_STEPS = sim_steps;
+    }
+    if (stability_metric > 0.5f) {
+        fprintf(stderr, "Warning: Simulation might be unstable!\n");
+        fprintf(stderr, "         (speed_sq * dt^2) = %.3f. For stability, this value should ideally be <= 0.5.\n", stability_metric);
+        fprintf(stderr, "         Consider reducing dt or speed_sq.\n");
+    }
+
+    int kernel = select_kernel();
+    if (kernel < 0) {
+        fprintf(stderr, "Error: kernel '%s' is not supported on this CPU.\n", KERNEL_NAMES[G_KERNEL]);
+        return 1;
+    }
+    select_storage_codec(kernel);
+    select_view_fold(kernel);
+    select_quantizer(kernel);
+    select_implicit_kernel(kernel);
+
+    double map_t0 = now_seconds();
+    if (G_RESTORE) {
+        // Grids were set up by checkpoint_restore()
+    } else if (G_MAP) {
+        if (G_GRID_W) { fprintf(stderr, "Error: --map cannot be combined with --grid (the map sets the grid).\n"); return 1; }
+        // Index the map with the full pool; it is resized once the height is known
+        pool_start(G_THREADS);
+        if (!map_open(G_MAP)) return 1;
+        pool_stop();
+        WIDTH = map_file.width;
+        HEIGHT = map_file.height;
+    } else if (G_GRID_W) {
+        WIDTH = G_GRID_W;
+        HEIGHT = G_GRID_H;
+    } else {
+        get_terminal_size(&WIDTH, &HEIGHT);
+        if (WIDTH < 10 || HEIGHT < 5) { // Ensure a minimum usable size
+            fprintf(stderr, "Terminal too small. Minimum 10x5 required. Using fallback 20x10.\n");
+            WIDTH = (WIDTH < 10) ? 20 : WIDTH; 
+            HEIGHT = (HEIGHT < 5) ? 10 : HEIGHT;
+        }
+    }
+
+    // The spectral mode's size check; its walls are checked once the grid is filled in
+    const char *spectral_why = G_INTEGRATOR == INTEGRATOR_SPECTRAL ? spectral_unsupported() : NULL;
+    if (spectral_why) { fprintf(stderr, "Error: --integrator spectral %s.\n", spectral_why); return 1; }
+
+    if (sweep_n_axes > 0) {
+        // Every combination runs in a worker process; nothing below applies
+        signal(SIGINT, handle_stop_signal);
+        signal(SIGTERM, handle_stop_signal);
+        int rc = run_sweep(steps_arg, G_SWEEP_OUT);
+        map_close();
+        return rc;
+    }
+
+    // Never use more workers than there are rows to share out
+    int threads = pool_start(G_THREADS < HEIGHT ? G_THREADS : HEIGHT);
+    if (!G_RESTORE) {
+        allocate_grids();
+        initialize_simulation();
+    }
+    spectral_why = G_INTEGRATOR == INTEGRATOR_SPECTRAL ? spectral_unsupported() : NULL;
+    if (spectral_why) { fprintf(stderr, "Error: --integrator spectral %s.\n", spectral_why); return 1; }
+    double map_seconds = now_seconds() - map_t0;
+    int sized_grid = G_GRID_W || G_RESTORE || G_MAP; // Grid not taken from the terminal
+    if (sized_grid && !G_HEADLESS) {
+        // Show the grid on the terminal, pooled down where it is larger
+        int term_w, term_h;
+        get_terminal_size(&term_w, &term_h);
+        if (term_w < VIEW_W) VIEW_W = term_w;
+        if (term_h < VIEW_H) VIEW_H = term_h;
+    }
+
+    printf("%s: %dx%d. Starting fluid sloshing simulation...\n", sized_grid ? "Grid" : "Terminal", WIDTH, HEIGHT);
+    if (G_MAP) {
+        printf("Map: %s (%s), loaded in %.0f ms\n", G_MAP,
+               map_file.pgm_bytes ? (map_file.pgm_bytes == 1 ? "PGM, 8-bit" : "PGM, 16-bit") : "ASCII", map_seconds * 1e3);
+    }
+    if (G_RESTORE) printf("Restored: step %lld, simulated time %.3f, from %s\n", g_step_count, g_sim_time, G_RESTORE);
+    printf("Parameters: DT=%.3f, SpeedSq=%.2f, Damping=%.3f, Level=%.2f, Tilt=%.2f, Sleep=%dms\n",
+           G_DT, G_WAVE_SPEED_SQ, G_DAMPING, G_INITIAL_WATER_LEVEL, G_INITIAL_TILT, G_SLEEP_MS);
+    if (VIEW_W != WIDTH || VIEW_H != HEIGHT) {
+        printf("View: %dx%d (%s pooling of %.1fx%.1f cell blocks)\n", VIEW_W, VIEW_H, POOL_NAMES[G_POOL],
+               (double)WIDTH / VIEW_W, (double)HEIGHT / VIEW_H);
+    }
+    printf("Kernel: %s", KERNEL_NAMES[kernel]);
+    if (G_TIME_BLOCK > 1) printf(", time-blocked %d steps per tile", G_TIME_BLOCK);
+    if (G_ACTIVE_TILES) printf(", active tiles (quiescence %g)", G_QUIESCENCE);
+    if (G_STORAGE != STORAGE_FP32) printf(", %s storage", STORAGE_CODECS[G_STORAGE].name);
+    if (G_INTEGRATOR == INTEGRATOR_IMPLICIT) printf(", implicit Crank-Nicolson (CG tol %g)", G_CG_TOL);
+    if (G_INTEGRATOR == INTEGRATOR_SPECTRAL) printf(", spectral (%dx%d cosine modes)", WIDTH - 2, HEIGHT - 2);
+    printf("\n");
+    if (G_PROCS > 1) {
+        // Never more slabs than rows
+        int procs = slab_start(G_PROCS < HEIGHT ? G_PROCS : HEIGHT);
+        if (!procs) return 1;
+        int nodes = 0; // Distinct nodes in use (slabs are handed to nodes in order)
+        for (int i = 0; i < procs; i++) nodes += slab.ws[i].node >= 0 && (i == 0 || slab.ws[i].node != slab.ws[i - 1].node);
+        printf("Processes: %d row slabs of ~%d rows, ", procs, HEIGHT / procs);
+        if (nodes > 0) printf("pinned across %d of %d NUMA node(s)\n", nodes, slab.n_nodes);
+        else printf("not pinned (no NUMA topology found)\n");
+    }
+
+    if (threads < G_THREADS) printf("Threads: using %d of %d requested\n", threads, G_THREADS);
+    // The scaling report re-initializes the simulation, which would discard a restored state
+    if (threads > 1 && !G_RESTORE) report_thread_scaling(threads);
+
+    if (stability_metric > 0.5f) printf("WARNING: POTENTIAL INSTABILITY (see details above)\n");
+
+    signal(SIGINT, handle_stop_signal);
+    signal(SIGTERM, handle_stop_signal);
+    stats_install();
+    perf_arm(); // After the scaling report, so only the run itself is counted
+
+    if (G_HEADLESS) {
+        // Batch run: step as fast as possible, in time-block sized chunks so an
+        // interrupt is noticed promptly, then report throughput
+        fflush(stdout);
+        double t0 = now_seconds();
+        long long first_step = g_step_count;
+        checkpoint_tick();
+        while (!run_finished()) {
+            // Slab workers take a batch per command (each command ends in a frame copy)
+            advance_frame(G_ADAPTIVE || slab.n > 0 ? 64.0 * G_TIME_BLOCK : G_TIME_BLOCK);
+            checkpoint_tick();
+            stats_poll();
+        }
+        double elapsed = now_seconds() - t0;
+        checkpoint_final();
+        report_throughput((long)(g_step_count - first_step), elapsed);
+        if (G_STATS) stats_report(stdout);
+        perf_report(); // Before the storage report re-runs the simulation
+        // The fp32 re-run starts from initialize_simulation(), so it cannot follow a restored run
+        if (G_STORAGE != STORAGE_FP32 && !g_stop && !G_RESTORE) report_storage_error();
+    } else {
+        SLEEP_MS(3000); // Give time to read parameters and warnings
+
+#ifdef CFD_THREADS
+        if (G_ASYNC_RENDER) run_async_render();
+#endif
+        // Main simulation loop: fixed timestep, deadline-paced frames
+        frame_pacer pacer;
+        pacer_init(&pacer, pacer_fps(), G_SIM_RATE, G_BASE_DT, G_TIME_BLOCK);
+        double last_render = now_seconds();
+        checkpoint_tick();
+        while (!G_ASYNC_RENDER && !run_finished()) {
+            // One step (or time block) per frame unless --sim-rate asks for more
+            advance_frame(G_ADAPTIVE ? pacer.steps_per_frame : (double)pacer_steps(&pacer));
+            checkpoint_tick();
+            // Behind schedule: skip drawing, but still show a frame at least once a second
+            if (pacer_on_time(&pacer) || now_seconds() - last_render > 1.0) {
+                display_grid();
+                last_render = now_seconds();
+            } else {
+                pacer.dropped++;
+            }
+            pacer_wait(&pacer);
+            stats_poll();
+        }
+        checkpoint_final();
+        if (!G_ASYNC_RENDER) {
+            printf("\nPacing: %ld frames, %ld missed deadlines, %ld renders dropped\n",
+                   pacer.frames, pacer.missed, pacer.dropped);
+        }
+        if (G_STATS) {
+            report_render_stats();
+            stats_report(stdout);
+        }
+        perf_report();
     }
 
-    free_grids(); // Technically unreachable due to infinite loop, but good practice
+    slab_stop();
+    pool_stop();
+    free_grids();
+    map_close();
     return 0;
 }
+#endif // CFD_NO_MAIN